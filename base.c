@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <wchar.h>
 
 struct stfl_widget_type *stfl_widget_types[] = {
@@ -47,6 +48,97 @@ struct stfl_widget_type *stfl_widget_types[] = {
 int id_counter = 0;
 int curses_active = 0;
 
+static unsigned int gen_counter = 0;
+static unsigned int tree_gen = 0;
+
+/*
+ * Bump the layout generation of w and its parents (see stfl_layout_gen). If
+ * inherited is set, the values w and the widgets below it inherit have
+ * changed, too.
+ */
+static void layout_touch(struct stfl_widget *w, int inherited)
+{
+	unsigned int gen = ++gen_counter;
+
+	if (inherited)
+		w->inherit_gen = gen;
+
+	for (; w; w = w->parent)
+		w->layout_gen = gen;
+}
+
+/*
+ * All widgets are kept in a hash table indexed by their id, so looking up
+ * the focused widget doesn't have to walk the whole tree. The table is
+ * shared by all forms and has its own lock, which also protects the widget
+ * id counter.
+ */
+
+static struct stfl_widget **widget_index = 0;
+static int widget_index_size = 0;
+static int widget_index_count = 0;
+static int widget_id_counter = 0;
+static pthread_mutex_t widget_index_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* give w a new id and add it to the index */
+static void widget_index_add(struct stfl_widget *w)
+{
+	pthread_mutex_lock(&widget_index_mtx);
+
+	w->id = ++widget_id_counter;
+
+	if (widget_index_count >= widget_index_size)
+	{
+		int new_size = widget_index_size ? widget_index_size * 2 : 256;
+		struct stfl_widget **new_index = calloc(new_size, sizeof(struct stfl_widget *));
+		int i;
+
+		for (i = 0; i < widget_index_size; i++)
+			while (widget_index[i]) {
+				struct stfl_widget *c = widget_index[i];
+				widget_index[i] = c->next_by_id;
+				c->next_by_id = new_index[c->id & (new_size-1)];
+				new_index[c->id & (new_size-1)] = c;
+			}
+
+		free(widget_index);
+		widget_index = new_index;
+		widget_index_size = new_size;
+	}
+
+	w->next_by_id = widget_index[w->id & (widget_index_size-1)];
+	widget_index[w->id & (widget_index_size-1)] = w;
+	widget_index_count++;
+
+	pthread_mutex_unlock(&widget_index_mtx);
+}
+
+static void widget_index_remove(struct stfl_widget *w)
+{
+	pthread_mutex_lock(&widget_index_mtx);
+
+	struct stfl_widget **wp = &widget_index[w->id & (widget_index_size-1)];
+	while (*wp != w)
+		wp = &(*wp)->next_by_id;
+	*wp = w->next_by_id;
+	widget_index_count--;
+
+	pthread_mutex_unlock(&widget_index_mtx);
+}
+
+/* widgets that are not indexed (see stfl_widget_template()) have the id 0 */
+static struct stfl_widget *widget_alloc(struct stfl_widget_type *t, int setfocus, int indexed)
+{
+	struct stfl_widget *w = calloc(1, sizeof(struct stfl_widget));
+	w->type = t;
+	w->setfocus = setfocus;
+	if (indexed)
+		widget_index_add(w);
+	if (w->type->f_init)
+		w->type->f_init(w);
+	return w;
+}
+
 struct stfl_widget *stfl_widget_new(const wchar_t *type)
 {
 	struct stfl_widget_type *t;
@@ -65,13 +157,7 @@ struct stfl_widget *stfl_widget_new(const wchar_t *type)
 	if (!t)
 		return 0;
 
-	struct stfl_widget *w = calloc(1, sizeof(struct stfl_widget));
-	w->id = ++id_counter;
-	w->type = t;
-	w->setfocus = setfocus;
-	if (w->type->f_init)
-		w->type->f_init(w);
-	return w;
+	return widget_alloc(t, setfocus, 1);
 }
 
 void stfl_widget_free(struct stfl_widget *w)
@@ -82,6 +168,9 @@ void stfl_widget_free(struct stfl_widget *w)
 	if (w->type->f_done)
 		w->type->f_done(w);
 
+	if (w->id)
+		widget_index_remove(w);
+
 	struct stfl_kv *kv = w->kv_list;
 	while (kv) {
 		struct stfl_kv *next = kv->next;
@@ -89,27 +178,13 @@ void stfl_widget_free(struct stfl_widget *w)
 		free(kv->value);
 		if (kv->name)
 			free(kv->name);
+		if (kv->richtext)
+			stfl_richtext_free(kv->richtext);
 		free(kv);
 		kv = next;
 	}
 
-	if (w->parent)
-	{
-		struct stfl_widget **pp = &w->parent->first_child;
-		while (*pp != w) {
-			pp = &(*pp)->next_sibling;
-		}
-		*pp = w->next_sibling;
-
-		if (w->parent->last_child == w) {
-			struct stfl_widget *p = w->parent->first_child;
-			w->parent->last_child = 0;
-			while (p) {
-				w->parent->last_child = p;
-				p = p->next_sibling;
-			}
-		}
-	}
+	stfl_widget_unlink(w);
 
 	if (w->name)
 		free(w->name);
@@ -120,6 +195,185 @@ void stfl_widget_free(struct stfl_widget *w)
 	free(w);
 }
 
+/* copy s with prefix (of length plen) prepended */
+static wchar_t *clone_str(const wchar_t *prefix, size_t plen, const wchar_t *s)
+{
+	size_t len = wcslen(s);
+	wchar_t *r = malloc((plen + len + 1) * sizeof(wchar_t));
+
+	wmemcpy(r, prefix, plen);
+	wmemcpy(r + plen, s, len + 1);
+	return r;
+}
+
+static struct stfl_widget *widget_clone(struct stfl_widget *w, const wchar_t *prefix, size_t plen, int indexed)
+{
+	struct stfl_widget *n = widget_alloc(w->type, w->setfocus, indexed);
+	struct stfl_widget *first = 0, *last = 0, *c;
+	struct stfl_kv *kv, **tail = &n->kv_list;
+
+	n->parser_indent = w->parser_indent;
+	n->name = w->name ? clone_str(prefix, plen, w->name) : 0;
+	n->cls = w->cls ? clone_str(L"", 0, w->cls) : 0;
+
+	stfl_widget_sync(w);
+	for (kv = w->kv_list; kv; kv = kv->next) {
+		struct stfl_kv *k = calloc(1, sizeof(struct stfl_kv));
+		k->widget = n;
+		k->key = clone_str(L"", 0, kv->key);
+		k->value = clone_str(L"", 0, kv->value);
+		k->name = kv->name ? clone_str(prefix, plen, kv->name) : 0;
+		k->id = ++id_counter;
+		k->gen = ++gen_counter;
+		*tail = k;
+		tail = &k->next;
+	}
+
+	for (c = w->first_child; c; c = c->next_sibling) {
+		struct stfl_widget *cc = widget_clone(c, prefix, plen, indexed);
+		if (last)
+			last->next_sibling = cc;
+		else
+			first = cc;
+		last = cc;
+	}
+
+	stfl_widget_insert(n, 0, first);
+	return n;
+}
+
+/* make a copy of w and all its children with prefix added to all names, the copy has no parent */
+struct stfl_widget *stfl_widget_clone(struct stfl_widget *w, const wchar_t *prefix)
+{
+	prefix = prefix ? prefix : L"";
+	return widget_clone(w, prefix, wcslen(prefix), 1);
+}
+
+/* make a copy of w to be kept aside, it can't be used in a form but only be cloned again */
+struct stfl_widget *stfl_widget_template(struct stfl_widget *w)
+{
+	return widget_clone(w, L"", 0, 0);
+}
+
+/* link the sibling chain starting at first into parent, before next (or at the end) */
+void stfl_widget_insert(struct stfl_widget *parent, struct stfl_widget *next, struct stfl_widget *first)
+{
+	struct stfl_widget *prev = next ? next->prev_sibling : parent->last_child;
+	struct stfl_widget *last = 0, *c;
+
+	if (!first)
+		return;
+
+	for (c = first; c; c = c->next_sibling) {
+		c->parent = parent;
+		c->prev_sibling = last;
+		last = c;
+	}
+
+	first->prev_sibling = prev;
+	if (prev)
+		prev->next_sibling = first;
+	else
+		parent->first_child = first;
+
+	last->next_sibling = next;
+	if (next)
+		next->prev_sibling = last;
+	else
+		parent->last_child = last;
+
+	stfl_index_insert(parent, first, next);
+	stfl_widget_touch(parent);
+	for (c = first; c; c = c->next_sibling) {
+		layout_touch(c, 1);
+		if (c == last)
+			break;
+	}
+	tree_gen++;
+}
+
+void stfl_widget_unlink(struct stfl_widget *w)
+{
+	struct stfl_widget *p = w->parent;
+
+	if (!p)
+		return;
+
+	stfl_index_remove(p, w);
+
+	if (w->prev_sibling)
+		w->prev_sibling->next_sibling = w->next_sibling;
+	else
+		p->first_child = w->next_sibling;
+
+	if (w->next_sibling)
+		w->next_sibling->prev_sibling = w->prev_sibling;
+	else
+		p->last_child = w->prev_sibling;
+
+	w->parent = w->next_sibling = w->prev_sibling = 0;
+	stfl_widget_touch(p);
+	layout_touch(p, 0);
+	layout_touch(w, 1);
+	tree_gen++;
+}
+
+void stfl_widget_sync(struct stfl_widget *w)
+{
+	if (w->type->f_sync)
+		w->type->f_sync(w);
+}
+
+/* mark the children of w (or their variables) as changed */
+void stfl_widget_touch(struct stfl_widget *w)
+{
+	w->child_gen = ++gen_counter;
+}
+
+/*
+ * The layout generation of a widget changes whenever widgets are added to or
+ * removed from its subtree or a variable is set there that the table layout
+ * or the focus order depend on: the '.' variables and can_focus. Plain values
+ * like text or pos don't change it. '@' defaults may be inherited by any
+ * widget below, so setting them (or moving a subtree) bumps the inherit
+ * generation of that widget, which counts for its whole subtree.
+ */
+unsigned int stfl_layout_gen(struct stfl_widget *w)
+{
+	unsigned int gen = w->layout_gen;
+
+	for (; w; w = w->parent)
+		if (w->inherit_gen > gen)
+			gen = w->inherit_gen;
+
+	return gen;
+}
+
+void stfl_kv_setvalue(struct stfl_kv *kv, const wchar_t *value)
+{
+	wchar_t *old_value = kv->value;
+
+	if (old_value && !wcscmp(old_value, value))
+		return;
+
+	kv->value = compat_wcsdup(value);
+	kv->gen = ++gen_counter;
+	free(old_value);
+
+	if (kv->richtext) {
+		stfl_richtext_free(kv->richtext);
+		kv->richtext = 0;
+	}
+
+	if (kv->widget->parent)
+		stfl_widget_touch(kv->widget->parent);
+
+	if (kv->key[0] == L'@')
+		layout_touch(kv->widget, 1);
+	else if (kv->key[0] == L'.' || !wcscmp(kv->key, L"can_focus"))
+		layout_touch(kv->widget, 0);
+}
+
 extern struct stfl_kv *stfl_widget_setkv_int(struct stfl_widget *w, const wchar_t *key, int value)
 {
 	wchar_t newtext[64];
@@ -132,8 +386,7 @@ struct stfl_kv *stfl_widget_setkv_str(struct stfl_widget *w, const wchar_t *key,
 	struct stfl_kv *kv = w->kv_list;
 	while (kv) {
 		if (!wcscmp(kv->key, key)) {
-			free(kv->value);
-			kv->value = compat_wcsdup(value);
+			stfl_kv_setvalue(kv, value);
 			return kv;
 		}
 		kv = kv->next;
@@ -142,8 +395,8 @@ struct stfl_kv *stfl_widget_setkv_str(struct stfl_widget *w, const wchar_t *key,
 	kv = calloc(1, sizeof(struct stfl_kv));
 	kv->widget = w;
 	kv->key = compat_wcsdup(key);
-	kv->value = compat_wcsdup(value);
 	kv->id = ++id_counter;
+	stfl_kv_setvalue(kv, value);
 	kv->next = w->kv_list;
 	w->kv_list = kv;
 	return kv;
@@ -163,8 +416,7 @@ extern struct stfl_kv *stfl_setkv_by_name_str(struct stfl_widget *w, const wchar
 	if (!kv)
 		return 0;
 
-	free(kv->value);
-	kv->value = compat_wcsdup(value);
+	stfl_kv_setvalue(kv, value);
 	return kv;
 }
 
@@ -275,25 +527,33 @@ struct stfl_widget *stfl_widget_by_name(struct stfl_widget *w, const wchar_t *na
 
 struct stfl_widget *stfl_widget_by_id(struct stfl_widget *w, int id)
 {
-	if (w->id == id)
-		return w;
-
-	w = w->first_child;
-	while (w) {
-		struct stfl_widget *r = stfl_widget_by_id(w, id);
-		if (r) return r;
-		w = w->next_sibling;
+	struct stfl_widget *r, *c;
+
+	pthread_mutex_lock(&widget_index_mtx);
+
+	/* only return widgets from the subtree of w */
+	for (r = widget_index_size ? widget_index[id & (widget_index_size-1)] : 0; r; r = r->next_by_id) {
+		if (r->id != id)
+			continue;
+		c = r;
+		while (c && c != w)
+			c = c->parent;
+		if (c)
+			break;
 	}
 
-	return 0;
+	pthread_mutex_unlock(&widget_index_mtx);
+	return r;
 }
 
 struct stfl_kv *stfl_kv_by_name(struct stfl_widget *w, const wchar_t *name)
 {
 	struct stfl_kv *kv = w->kv_list;
 	while (kv) {
-		if (kv->name && !wcscmp(kv->name, name))
+		if (kv->name && !wcscmp(kv->name, name)) {
+			stfl_widget_sync(w);
 			return kv;
+		}
 		kv = kv->next;
 	}
 
@@ -361,11 +621,9 @@ int stfl_focus_prev(struct stfl_widget *w, struct stfl_widget *old_fw, struct st
 
 	assert(stop);
 
-	while (w->first_child != stop)
+	while (stop->prev_sibling)
 	{
-		struct stfl_widget *c = w->first_child;
-		while (c->next_sibling != stop)
-			c = c->next_sibling;
+		struct stfl_widget *c = stop->prev_sibling;
 
 		struct stfl_widget *new_fw = stfl_find_first_focusable(c);
 		if (new_fw) {
@@ -432,7 +690,11 @@ struct stfl_form *stfl_form_new()
 {
 	struct stfl_form *f = calloc(1, sizeof(struct stfl_form));
 	if (f) {
-		pthread_mutex_init(&f->mtx, NULL);
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&f->mtx, &attr);
+		pthread_mutexattr_destroy(&attr);
 	}
 	return f;
 }
@@ -461,6 +723,211 @@ static struct stfl_widget* stfl_gather_focus_widget(struct stfl_form* f)
 	return fw;
 }
 
+/*
+ * Every widget links to the nearest focusable widgets after and before it
+ * in document order (wrapping around at the ends), so TAB and BTAB don't
+ * have to walk the tree. The links are rebuilt when the layout generation
+ * of the form root has changed (widgets added or removed in this form, or
+ * can_focus, .display or the '@' defaults they inherit set), so changes in
+ * other forms don't invalidate them.
+ */
+
+static int focus_order_add(struct stfl_form *f, struct stfl_widget *w, int n)
+{
+	if (n == f->focus_order_alloc) {
+		f->focus_order_alloc = f->focus_order_alloc * 2 + 64;
+		f->focus_order = realloc(f->focus_order, f->focus_order_alloc * sizeof(struct stfl_widget *));
+	}
+	f->focus_order[n++] = w;
+
+	for (w = w->first_child; w; w = w->next_sibling)
+		n = focus_order_add(f, w, n);
+
+	return n;
+}
+
+static void stfl_focus_ring(struct stfl_form *f)
+{
+	struct stfl_widget *first = 0, *last = 0, *w;
+	int i, n, pending = 0;
+
+	if (f->focus_order && f->focus_root_id == f->root->id &&
+	    f->focus_gen == stfl_layout_gen(f->root))
+		return;
+
+	n = focus_order_add(f, f->root, 0);
+
+	/* widgets from pending to i-1 are still waiting for their next link */
+	for (i = 0; i < n; i++) {
+		w = f->focus_order[i];
+		w->focus_prev = last;
+		if (w->allow_focus && stfl_widget_getkv_int(w, L"can_focus", 1) &&
+		    stfl_widget_getkv_int(w, L".display", 1)) {
+			while (pending < i)
+				f->focus_order[pending++]->focus_next = w;
+			if (!first)
+				first = w;
+			last = w;
+		}
+	}
+
+	while (pending < n)
+		f->focus_order[pending++]->focus_next = first;
+
+	for (i = 0; i < n && !f->focus_order[i]->focus_prev; i++)
+		f->focus_order[i]->focus_prev = last;
+
+	f->focus_root_id = f->root->id;
+	f->focus_gen = stfl_layout_gen(f->root);
+}
+
+/*
+ * While a transaction is open (see stfl_begin()), name lookups go through a
+ * hash table of all widget and variable names in the form, so a batch of
+ * stfl_set() and stfl_get() calls only walks the tree once. The table is
+ * rebuilt when widgets have been added or removed in the meantime.
+ */
+
+static unsigned int name_hash(const wchar_t *name)
+{
+	unsigned int hash = 0;
+	while (*name)
+		hash = hash * 31 + *(name++);
+	return hash;
+}
+
+static struct stfl_name_entry *name_cache_find(struct stfl_form *f, const wchar_t *name)
+{
+	int i = f->name_buckets[name_hash(name) & (f->name_buckets_size-1)];
+
+	while (i >= 0) {
+		if (!wcscmp(f->names[i].name, name))
+			return &f->names[i];
+		i = f->names[i].next;
+	}
+
+	return 0;
+}
+
+static void name_cache_add(struct stfl_form *f, const wchar_t *name, struct stfl_widget *w, struct stfl_kv *kv)
+{
+	struct stfl_name_entry *e = name_cache_find(f, name);
+
+	if (!e) {
+		int bucket = name_hash(name) & (f->name_buckets_size-1);
+		if (f->names_count == f->names_alloc) {
+			f->names_alloc = f->names_alloc * 2 + 64;
+			f->names = realloc(f->names, f->names_alloc * sizeof(struct stfl_name_entry));
+		}
+		e = &f->names[f->names_count];
+		e->name = name;
+		e->widget = 0;
+		e->kv = 0;
+		e->next = f->name_buckets[bucket];
+		f->name_buckets[bucket] = f->names_count++;
+	}
+
+	/* the first match in document order wins, like in the tree walks */
+	if (w && !e->widget)
+		e->widget = w;
+	if (kv && !e->kv)
+		e->kv = kv;
+}
+
+static int name_cache_walk(struct stfl_form *f, struct stfl_widget *w, int count)
+{
+	struct stfl_kv *kv;
+
+	if (w->name) {
+		if (f)
+			name_cache_add(f, w->name, w, 0);
+		count++;
+	}
+
+	for (kv = w->kv_list; kv; kv = kv->next)
+		if (kv->name) {
+			if (f)
+				name_cache_add(f, kv->name, 0, kv);
+			count++;
+		}
+
+	for (w = w->first_child; w; w = w->next_sibling)
+		count = name_cache_walk(f, w, count);
+
+	return count;
+}
+
+static int name_cache_update(struct stfl_form *f)
+{
+	int count, i;
+
+	if (!f->batch || !f->root)
+		return 0;
+
+	if (f->names_root == f->root && f->names_gen == tree_gen)
+		return 1;
+
+	count = name_cache_walk(0, f->root, 0);
+
+	if (f->name_buckets_size < count || f->name_buckets_size == 0) {
+		f->name_buckets_size = 64;
+		while (f->name_buckets_size < count)
+			f->name_buckets_size *= 2;
+		f->name_buckets = realloc(f->name_buckets, f->name_buckets_size * sizeof(int));
+	}
+
+	for (i = 0; i < f->name_buckets_size; i++)
+		f->name_buckets[i] = -1;
+	f->names_count = 0;
+
+	name_cache_walk(f, f->root, 0);
+	f->names_root = f->root;
+	f->names_gen = tree_gen;
+	return 1;
+}
+
+struct stfl_widget *stfl_form_widget_by_name(struct stfl_form *f, const wchar_t *name)
+{
+	struct stfl_name_entry *e;
+
+	if (!name_cache_update(f))
+		return f->root ? stfl_widget_by_name(f->root, name) : 0;
+
+	e = name_cache_find(f, name);
+	return e ? e->widget : 0;
+}
+
+struct stfl_kv *stfl_form_kv_by_name(struct stfl_form *f, const wchar_t *name)
+{
+	struct stfl_name_entry *e;
+
+	if (!name_cache_update(f))
+		return f->root ? stfl_kv_by_name(f->root, name) : 0;
+
+	e = name_cache_find(f, name);
+	if (!e || !e->kv)
+		return 0;
+
+	stfl_widget_sync(e->kv->widget);
+	return e->kv;
+}
+
+void stfl_form_begin(struct stfl_form *f)
+{
+	pthread_mutex_lock(&f->mtx);
+	f->batch++;
+}
+
+/* must be paired with stfl_form_begin() by the same thread */
+void stfl_form_commit(struct stfl_form *f)
+{
+	if (f->batch == 0)
+		return;
+	if (--f->batch == 0)
+		f->names_root = 0;
+	pthread_mutex_unlock(&f->mtx);
+}
+
 void stfl_form_run(struct stfl_form *f, int timeout)
 {
 	wchar_t *on_handler = 0;
@@ -482,6 +949,8 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 		abort();
 	}
 
+	stfl_curses_lock();
+
 	if (!curses_active)
 	{
 		initscr();
@@ -496,7 +965,7 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 		curses_active = 1;
 	}
 
-	stfl_colorpair_counter = 1;
+	stfl_style_frame(stdscr);
 	f->root->type->f_prepare(f->root, f);
 
 	struct stfl_widget *fw = stfl_gather_focus_widget(f);
@@ -513,6 +982,7 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 		}
 		f->root->type->f_draw(f->root, f, dummywin);
 		delwin(dummywin);
+		stfl_curses_unlock();
 		pthread_mutex_unlock(&f->mtx);
 		return;
 	}
@@ -525,6 +995,7 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 	refresh();
 
 	if (timeout < 0) {
+		stfl_curses_unlock();
 		pthread_mutex_unlock(&f->mtx);
 		return;
 	}
@@ -532,9 +1003,13 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 	wtimeout(stdscr, timeout == 0 ? -1 : timeout);
 	wmove(stdscr, f->cursor_y, f->cursor_x);
 
+	/* refresh here, so wget_wch() only reads input while unlocked */
+	wrefresh(stdscr);
+	WINDOW *win = stdscr;
 	wint_t wch;
+	stfl_curses_unlock();
 	pthread_mutex_unlock(&f->mtx);
-	int rc = wget_wch(stdscr, &wch);
+	int rc = wget_wch(win, &wch);
 	pthread_mutex_lock(&f->mtx);
 
 	/* fw may be invalid, regather it */
@@ -577,22 +1052,8 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 		if (!fw)
 			goto generate_event;
 
-		do {
-			if (fw->first_child)
-				fw = fw->first_child;
-			else
-			if (fw->next_sibling)
-				fw = fw->next_sibling;
-			else
-			{
-				while (fw->parent && !fw->parent->next_sibling)
-					fw = fw->parent;
-				fw = fw->parent ? fw->parent->next_sibling : 0;
-			}
-
-			if (!fw && old_fw)
-				fw = f->root;
-		} while (fw && !(fw->allow_focus && stfl_widget_getkv_int(fw, L"can_focus", 1)));
+		stfl_focus_ring(f);
+		fw = old_fw->focus_next;
 
 		if (old_fw != fw)
 		{
@@ -610,33 +1071,10 @@ void stfl_form_run(struct stfl_form *f, int timeout)
 	else if (rc == KEY_CODE_YES && wch == KEY_BTAB)
 	{
 		struct stfl_widget *old_fw = stfl_widget_by_id(f->root, f->current_focus_id);
-		struct stfl_widget *tmp_fw = f->root;
-		struct stfl_widget *fw = 0;
+		struct stfl_widget *fw;
 
-focus_wrap_around:
-		while (tmp_fw && tmp_fw != old_fw)
-		{
-			if (tmp_fw->allow_focus && stfl_widget_getkv_int(tmp_fw, L"can_focus", 1))
-				fw = tmp_fw;
-
-			if (tmp_fw->first_child)
-				tmp_fw = tmp_fw->first_child;
-			else
-			if (tmp_fw->next_sibling)
-				tmp_fw = tmp_fw->next_sibling;
-			else
-			{
-				while (tmp_fw->parent && !tmp_fw->parent->next_sibling)
-					tmp_fw = tmp_fw->parent;
-				tmp_fw = tmp_fw->parent ? tmp_fw->parent->next_sibling : 0;
-			}
-		}
-
-		if (!fw && old_fw)
-		{
-			old_fw = f->root->last_child;
-			goto focus_wrap_around;
-		}
+		stfl_focus_ring(f);
+		fw = old_fw ? old_fw->focus_prev : f->root->focus_prev;
 
 		if (fw && old_fw != fw)
 		{
@@ -667,18 +1105,39 @@ unshift_next_event:;
 	free(on_handler);
 }
 
+/* prepare and draw the form to win (h lines of w columns), the caller holds f->mtx */
+void stfl_form_draw(struct stfl_form *f, WINDOW *win, int w, int h)
+{
+	stfl_style_frame(stdscr);
+	f->root->type->f_prepare(f->root, f);
+
+	struct stfl_widget *fw = stfl_gather_focus_widget(f);
+	f->current_focus_id = fw ? fw->id : 0;
+
+	f->root->x = f->root->y = 0;
+	f->root->w = w;
+	f->root->h = h;
+
+	werase(win);
+	f->root->type->f_draw(f->root, f, win);
+}
+
 void stfl_form_reset()
 {
+	stfl_curses_lock();
 	if (curses_active) {
 		endwin();
 		curses_active = 0;
 	}
+	stfl_curses_unlock();
 }
 
 void stfl_form_redraw()
 {
+	stfl_curses_lock();
 	if (curses_active)
 		clearok(curscr, 1);
+	stfl_curses_unlock();
 }
 
 void stfl_form_free(struct stfl_form *f)
@@ -688,6 +1147,9 @@ void stfl_form_free(struct stfl_form *f)
 		stfl_widget_free(f->root);
 	if (f->event)
 		free(f->event);
+	free(f->focus_order);
+	free(f->names);
+	free(f->name_buckets);
 	pthread_mutex_unlock(&f->mtx);
 	free(f);
 }
@@ -722,57 +1184,199 @@ static unsigned int compute_len_from_width(const wchar_t *p, unsigned int width)
 	return len;
 }
 
-unsigned int stfl_print_richtext(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, const wchar_t * text, unsigned int width, const wchar_t * style_normal, int has_focus)
+/*
+ * Richtext is parsed into a list of spans. Each span switches to a style
+ * (or keeps the current one) and then prints a run of the tag-less text.
+ * The position of the span in the original text is kept as well, so a
+ * range of it (e.g. a wrapped row) can be printed from the same spans.
+ * The parsed form of a kv value is cached in the kv until it changes, the
+ * tag styles are resolved once per widget and generation of the tree.
+ */
+
+static void richtext_add_span(struct stfl_richtext *rt, int style, int start, int pos, int len)
 {
+	if (style == STFL_RICHTEXT_KEEP && rt->span_count > 0) {
+		struct stfl_richtext_span *last = &rt->spans[rt->span_count-1];
+		if (last->start + last->len == start && last->pos + last->len == pos) {
+			last->len += len;
+			return;
+		}
+	}
+
+	if (rt->span_count == rt->span_alloc) {
+		rt->span_alloc = rt->span_alloc * 2 + 4;
+		rt->spans = realloc(rt->spans, rt->span_alloc * sizeof(struct stfl_richtext_span));
+	}
+
+	rt->spans[rt->span_count].style = style;
+	rt->spans[rt->span_count].start = start;
+	rt->spans[rt->span_count].pos = pos;
+	rt->spans[rt->span_count].len = len;
+	rt->span_count++;
+}
+
+static int richtext_add_tag(struct stfl_richtext *rt, const wchar_t *name, int len)
+{
+	int i;
+
+	for (i = 0; i < rt->tag_count; i++)
+		if (!wcsncmp(rt->tags[i], name, len) && rt->tags[i][len] == 0)
+			return i;
+
+	if (rt->tag_count == rt->tag_alloc) {
+		rt->tag_alloc = rt->tag_alloc * 2 + 4;
+		rt->tags = realloc(rt->tags, rt->tag_alloc * sizeof(wchar_t*));
+		rt->styles = realloc(rt->styles, rt->tag_alloc * sizeof(wchar_t*));
+	}
+
+	rt->tags[i] = malloc((len + 1) * sizeof(wchar_t));
+	wmemcpy(rt->tags[i], name, len);
+	rt->tags[i][len] = 0;
+	rt->styles[i] = 0;
+
+	return rt->tag_count++;
+}
+
+struct stfl_richtext *stfl_richtext_parse(const wchar_t *text)
+{
+	struct stfl_richtext *rt = calloc(1, sizeof(struct stfl_richtext));
 	const wchar_t *p = text;
-	unsigned int retval = 0;
+	int len = 0;
 
-	unsigned int end_col = x + width;
+	rt->text = malloc((wcslen(text) + 1) * sizeof(wchar_t));
 
 	while (*p) {
-		unsigned int len = compute_len_from_width(p, end_col - x);
 		const wchar_t *p1 = wcschr(p, L'<');
-		if (NULL == p1) {
-			mvwaddnwstr(win, y, x, p, len);
-			retval += len;
+		const wchar_t *p2;
+
+		if (p1 == NULL)
+			p1 = p + wcslen(p);
+
+		wmemcpy(rt->text + len, p, p1 - p);
+		richtext_add_span(rt, STFL_RICHTEXT_KEEP, len, p - text, p1 - p);
+		len += p1 - p;
+
+		if (*p1 == 0 || (p2 = wcschr(p1 + 1, L'>')) == NULL)
 			break;
+
+		if (p2 == p1 + 1) {
+			rt->text[len] = L'<';
+			richtext_add_span(rt, STFL_RICHTEXT_KEEP, len, p1 - text, 1);
+			len++;
+		} else if (p2 == p1 + 2 && p1[1] == L'/') {
+			richtext_add_span(rt, STFL_RICHTEXT_NORMAL, len, p1 - text, 0);
 		} else {
-			const wchar_t *p2 = wcschr(p1 + 1, L'>');
-
-			if (len > (p1 - p))
-				len = p1 - p;
-			mvwaddnwstr(win, y, x, p, len);
-			retval += len;
-			x += wcswidth(p, len);
-
-			if (p2) {
-				wchar_t stylename[p2 - p1];
-				wmemcpy(stylename, p1 + 1, p2 - p1 - 1);
-				stylename[p2 - p1 - 1] = L'\0';
-				if (wcscmp(stylename,L"")==0) {
-					if (end_col - x > 0) {
-						mvwaddnwstr(win, y, x, L"<", 1);
-						retval += 1;
-						++x;
-					}
-				} else if (wcscmp(stylename, L"/")==0) {
-					stfl_style(win, style_normal);
-				} else {
-					wchar_t lookup_stylename[128];
-					const wchar_t * style;
-					if (has_focus)
-						swprintf(lookup_stylename, sizeof(lookup_stylename)/sizeof(*lookup_stylename), L"style_%ls_focus", stylename);
-					else
-						swprintf(lookup_stylename, sizeof(lookup_stylename)/sizeof(*lookup_stylename), L"style_%ls_normal", stylename);
-					style = stfl_widget_getkv_str(w, lookup_stylename, L"");
-					stfl_style(win, style);
-				}
-				p = p2 + 1;
-			} else {
-				break;
-			}
+			richtext_add_span(rt, richtext_add_tag(rt, p1 + 1, p2 - p1 - 1), len, p1 - text, 0);
 		}
+
+		p = p2 + 1;
 	}
+
+	rt->text[len] = 0;
+	return rt;
+}
+
+void stfl_richtext_free(struct stfl_richtext *rt)
+{
+	int i;
+
+	for (i = 0; i < rt->tag_count; i++)
+		free(rt->tags[i]);
+
+	free(rt->tags);
+	free(rt->styles);
+	free(rt->spans);
+	free(rt->text);
+	free(rt);
+}
+
+struct stfl_richtext *stfl_kv_richtext(struct stfl_kv *kv)
+{
+	if (!kv->richtext)
+		kv->richtext = stfl_richtext_parse(kv->value);
+	return kv->richtext;
+}
+
+static const wchar_t *richtext_style(struct stfl_widget *w, struct stfl_richtext *rt, int tag, int has_focus)
+{
+	if (rt->styles_widget != w || rt->styles_gen != gen_counter || rt->styles_focus != has_focus) {
+		memset(rt->styles, 0, rt->tag_count * sizeof(wchar_t*));
+		rt->styles_widget = w;
+		rt->styles_gen = gen_counter;
+		rt->styles_focus = has_focus;
+	}
+
+	if (!rt->styles[tag]) {
+		wchar_t lookup_stylename[128];
+		if (has_focus)
+			swprintf(lookup_stylename, sizeof(lookup_stylename)/sizeof(*lookup_stylename), L"style_%ls_focus", rt->tags[tag]);
+		else
+			swprintf(lookup_stylename, sizeof(lookup_stylename)/sizeof(*lookup_stylename), L"style_%ls_normal", rt->tags[tag]);
+		rt->styles[tag] = stfl_widget_getkv_str(w, lookup_stylename, L"");
+	}
+
+	return rt->styles[tag];
+}
+
+/* print the part of the text between the original positions from and to */
+static unsigned int print_spans(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, struct stfl_richtext *rt, int from, int to, unsigned int width, const wchar_t * style_normal, int has_focus)
+{
+	unsigned int retval = 0;
+	unsigned int end_col = x + width;
+	int i;
+
+	for (i = 0; i < rt->span_count; i++)
+	{
+		struct stfl_richtext_span *s = &rt->spans[i];
+		int skip = from > s->pos ? from - s->pos : 0;
+
+		if (s->pos >= to)
+			break;
+		if (s->pos + s->len <= from && (s->len > 0 || s->pos < from))
+			continue;
+
+		if (s->style == STFL_RICHTEXT_NORMAL)
+			stfl_style(win, style_normal);
+		else if (s->style != STFL_RICHTEXT_KEEP)
+			stfl_style(win, richtext_style(w, rt, s->style, has_focus));
+
+		if (s->len == 0 || x >= end_col)
+			continue;
+
+		unsigned int len = compute_len_from_width(rt->text + s->start + skip, end_col - x);
+		if (len > s->len - skip)
+			len = s->len - skip;
+		if (len > to - s->pos - skip)
+			len = to - s->pos - skip;
+
+		mvwaddnwstr(win, y, x, rt->text + s->start + skip, len);
+		retval += len;
+		x += wcswidth(rt->text + s->start + skip, len);
+	}
+
 	return retval;
 }
 
+unsigned int stfl_print_richtext(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, const wchar_t * text, unsigned int width, const wchar_t * style_normal, int has_focus)
+{
+	struct stfl_richtext *rt = stfl_richtext_parse(text);
+	unsigned int retval = print_spans(w, win, y, x, rt, 0, INT_MAX, width, style_normal, has_focus);
+	stfl_richtext_free(rt);
+	return retval;
+}
+
+unsigned int stfl_print_richtext_kv(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, struct stfl_kv *kv, unsigned int width, const wchar_t * style_normal, int has_focus)
+{
+	if (!kv)
+		return 0;
+	return print_spans(w, win, y, x, stfl_kv_richtext(kv), 0, INT_MAX, width, style_normal, has_focus);
+}
+
+/* like stfl_print_richtext_kv(), but only the part of the value from from to to */
+unsigned int stfl_print_richtext_range(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, struct stfl_kv *kv, int from, int to, unsigned int width, const wchar_t * style_normal, int has_focus)
+{
+	if (!kv)
+		return 0;
+	return print_spans(w, win, y, x, stfl_kv_richtext(kv), from, to, width, style_normal, has_focus);
+}
+
@@ -0,0 +1,66 @@
+/*
+ *  STFL - The Structured Terminal Forms Language/Library
+ *  Copyright (C) 2006, 2007  Clifford Wolf <clifford@clifford.at>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *  
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301 USA
+ *
+ *  bench.c: Parser microbenchmark
+ */
+
+#include "stfl_internals.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Generates a form with <count> list/listitem pairs (default 100000) with
+ * quoted names and values and prints the mean time of <runs> (default 5)
+ * calls of stfl_parser() for it.
+ */
+
+int main(int argc, char **argv)
+{
+	int count = argc > 1 ? atoi(argv[1]) : 100000;
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	size_t size = count * 200 + 100;
+	wchar_t *text = malloc(size * sizeof(wchar_t)), *p = text;
+	struct timespec start, stop;
+	int i;
+
+	if (count < 0 || runs <= 0) {
+		fprintf(stderr, "Usage: %s [count [runs]]\n", argv[0]);
+		return 1;
+	}
+
+	p += swprintf(p, size, L"vbox[root]\n");
+	for (i = 0; i < count; i++)
+		p += swprintf(p, size - (p - text),
+				L"  list[list%d] .expand:0 style_focus:fg=red,bg=blue\n"
+				L"    listitem[\"item %d\"] text:\"Item number %d with some text\" can_focus:1\n",
+				i, i, i);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < runs; i++)
+		stfl_widget_free(stfl_parser(text));
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	printf("parse %d list/listitem pairs (%d characters): %.3fs\n", count, (int)(p - text),
+			((stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9) / runs);
+
+	free(text);
+	return 0;
+}
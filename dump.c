@@ -85,6 +85,8 @@ static void myquote(struct txtnode **txt, const wchar_t *text)
 
 static void mydump(struct stfl_widget *w, const wchar_t *prefix, int focus_id, struct txtnode **txt)
 {
+	stfl_widget_sync(w);
+
 	newtxt(txt, L"{%ls%ls", w->id == focus_id ? L"!" : L"", w->type->name);
 
 	if (w->cls)
@@ -20,28 +20,274 @@
  *  iconv.c: Helper functions for widechar conversion
  */
 
-#include "stfl.h"
+#include "stfl_internals.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <wchar.h>
 #include <iconv.h>
 #include <errno.h>
 #include <pthread.h>
 
+#if defined(__SSE2__) && WCHAR_MAX > 0xffff
+#  include <emmintrin.h>
+#  define UTF8_SSE2
+#endif
+
 struct stfl_ipool_entry {
 	void *data;
 	struct stfl_ipool_entry *next;
 };
 
+/*
+ * Converted strings and the list entries for stfl_ipool_add() are carved out
+ * of a chain of fixed size chunks. Flushing the pool frees the strings that
+ * were added with stfl_ipool_add() and rewinds to the first chunk, so the
+ * chunks are reused by the next round of conversions. Strings too large for
+ * a chunk are malloced and added to the list instead.
+ */
+
+#define IPOOL_CHUNK_SIZE 16384
+#define IPOOL_LARGE_SIZE 4096
+
+struct stfl_ipool_chunk {
+	struct stfl_ipool_chunk *next;
+	size_t used;
+	union {
+		void *p;
+		double d;
+		char data[IPOOL_CHUNK_SIZE];
+	} u;
+};
+
 struct stfl_ipool {
 	iconv_t to_wc_desc;
 	iconv_t from_wc_desc;
 	char *code;
 	struct stfl_ipool_entry *list;
+	struct stfl_ipool_chunk *chunks, *current;
 	pthread_mutex_t mtx;
+	int local;
+	struct stfl_ipool *next_local;
 };
 
+/* pools from stfl_ipool_thread() are only used by one thread and need no lock */
+
+static inline void ipool_lock(struct stfl_ipool *pool)
+{
+	if (!pool->local)
+		pthread_mutex_lock(&pool->mtx);
+}
+
+static inline void ipool_unlock(struct stfl_ipool *pool)
+{
+	if (!pool->local)
+		pthread_mutex_unlock(&pool->mtx);
+}
+
+static void *ipool_add_locked(struct stfl_ipool *pool, void *data);
+
+/* allocate from the chunks, the caller holds pool->mtx */
+static void *ipool_alloc(struct stfl_ipool *pool, size_t size)
+{
+	struct stfl_ipool_chunk *c = pool->current;
+	void *p;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	if (size > IPOOL_LARGE_SIZE)
+		return ipool_add_locked(pool, malloc(size));
+
+	if (c && c->used + size > IPOOL_CHUNK_SIZE) {
+		c = c->next;
+		if (c)
+			c->used = 0;
+	}
+
+	if (!c) {
+		c = malloc(sizeof(struct stfl_ipool_chunk));
+		c->next = 0;
+		c->used = 0;
+		if (pool->current)
+			pool->current->next = c;
+		else
+			pool->chunks = c;
+	}
+
+	pool->current = c;
+	p = c->u.data + c->used;
+	c->used += size;
+	return p;
+}
+
+/*
+ * UTF-8 is by far the most common encoding used with the ipool (all language
+ * bindings use it), so it is converted here directly instead of through
+ * iconv. Runs of ASCII characters are converted 16 at a time with SSE2 where
+ * available. Bytes that are not valid UTF-8 are taken as latin1 and wide
+ * characters that can't be encoded become '?', like in the iconv path.
+ */
+
+/* decode len bytes from in, out must have room for len+1 characters */
+size_t stfl_utf8_decode(wchar_t *out, const char *in, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)in, *end = s + len;
+	wchar_t *o = out;
+
+	while (s < end)
+	{
+		unsigned int ch = *s, min;
+		int n, k;
+
+#ifdef UTF8_SSE2
+		if (ch < 0x80 && end - s >= 16) {
+			const __m128i zero = _mm_setzero_si128();
+			while (end - s >= 16) {
+				__m128i v = _mm_loadu_si128((const __m128i *)s);
+				if (_mm_movemask_epi8(v))
+					break;
+				__m128i lo = _mm_unpacklo_epi8(v, zero);
+				__m128i hi = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128((__m128i *)(o+0), _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(o+4), _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128((__m128i *)(o+8), _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128((__m128i *)(o+12), _mm_unpackhi_epi16(hi, zero));
+				s += 16;
+				o += 16;
+			}
+			if (s == end)
+				break;
+			ch = *s;
+		}
+#endif
+
+		if (ch < 0x80) {
+			*(o++) = ch;
+			s++;
+			continue;
+		}
+
+		if ((ch & 0xe0) == 0xc0)
+			n = 1, ch &= 0x1f, min = 0x80;
+		else if ((ch & 0xf0) == 0xe0)
+			n = 2, ch &= 0x0f, min = 0x800;
+		else if ((ch & 0xf8) == 0xf0)
+			n = 3, ch &= 0x07, min = 0x10000;
+		else
+			goto invalid;
+
+		if (end - s <= n)
+			goto invalid;
+
+		for (k = 1; k <= n; k++) {
+			if ((s[k] & 0xc0) != 0x80)
+				goto invalid;
+			ch = (ch << 6) | (s[k] & 0x3f);
+		}
+
+		if (ch < min || ch > 0x10ffff || (ch >= 0xd800 && ch < 0xe000))
+			goto invalid;
+
+		*(o++) = ch;
+		s += n + 1;
+		continue;
+
+	invalid:
+		*(o++) = *(s++);
+	}
+
+	*o = 0;
+	return o - out;
+}
+
+/* number of bytes stfl_utf8_encode() writes for len characters, without the terminator */
+size_t stfl_utf8_length(const wchar_t *in, size_t len)
+{
+	const wchar_t *end = in + len;
+	size_t bytes = len;
+
+	for (; in < end; in++) {
+		uint32_t ch = *in;
+		if (ch < 0x80)
+			continue;
+		if (ch < 0x800)
+			bytes += 1;
+		else if (ch < 0x10000)
+			bytes += ch >= 0xd800 && ch < 0xe000 ? 0 : 2;
+		else if (ch < 0x110000)
+			bytes += 3;
+	}
+
+	return bytes;
+}
+
+/* encode len characters from in, out must have room for stfl_utf8_length()+1 bytes */
+size_t stfl_utf8_encode(char *out, const wchar_t *in, size_t len)
+{
+	const wchar_t *end = in + len;
+	unsigned char *o = (unsigned char *)out;
+
+	while (in < end)
+	{
+		uint32_t ch = *in;
+
+#ifdef UTF8_SSE2
+		if (ch < 0x80 && end - in >= 16) {
+			const __m128i high = _mm_set1_epi32(~0x7f);
+			const __m128i zero = _mm_setzero_si128();
+			while (end - in >= 16) {
+				__m128i a = _mm_loadu_si128((const __m128i *)(in+0));
+				__m128i b = _mm_loadu_si128((const __m128i *)(in+4));
+				__m128i c = _mm_loadu_si128((const __m128i *)(in+8));
+				__m128i d = _mm_loadu_si128((const __m128i *)(in+12));
+				__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high), zero)) != 0xffff)
+					break;
+				_mm_storeu_si128((__m128i *)o, _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+				in += 16;
+				o += 16;
+			}
+			if (in == end)
+				break;
+			ch = *in;
+		}
+#endif
+
+		if (ch < 0x80) {
+			*(o++) = ch;
+		} else if (ch < 0x800) {
+			*(o++) = 0xc0 | (ch >> 6);
+			*(o++) = 0x80 | (ch & 0x3f);
+		} else if (ch < 0x10000) {
+			if (ch >= 0xd800 && ch < 0xe000) {
+				*(o++) = '?';
+			} else {
+				*(o++) = 0xe0 | (ch >> 12);
+				*(o++) = 0x80 | ((ch >> 6) & 0x3f);
+				*(o++) = 0x80 | (ch & 0x3f);
+			}
+		} else if (ch < 0x110000) {
+			*(o++) = 0xf0 | (ch >> 18);
+			*(o++) = 0x80 | ((ch >> 12) & 0x3f);
+			*(o++) = 0x80 | ((ch >> 6) & 0x3f);
+			*(o++) = 0x80 | (ch & 0x3f);
+		} else {
+			*(o++) = '?';
+		}
+		in++;
+	}
+
+	*o = 0;
+	return o - (unsigned char *)out;
+}
+
+static int is_utf8(const char *code)
+{
+	return !strcasecmp(code, "UTF8") || !strcasecmp(code, "UTF-8");
+}
+
 struct stfl_ipool *stfl_ipool_create(const char *code)
 {
 	struct stfl_ipool *pool = malloc(sizeof(struct stfl_ipool));
@@ -53,21 +299,29 @@ struct stfl_ipool *stfl_ipool_create(const char *code)
 
 	pool->code = strdup(code);
 	pool->list = 0;
+	pool->chunks = pool->current = 0;
+	pool->local = 0;
+	pool->next_local = 0;
 
 	return pool;
 }
 
-void *stfl_ipool_add(struct stfl_ipool *pool, void *data)
+static void *ipool_add_locked(struct stfl_ipool *pool, void *data)
 {
-	struct stfl_ipool_entry *entry = malloc(sizeof(struct stfl_ipool_entry));
-
-	pthread_mutex_lock(&pool->mtx);
+	struct stfl_ipool_entry *entry = ipool_alloc(pool, sizeof(struct stfl_ipool_entry));
 
 	entry->data = data;
 	entry->next = pool->list;
 	pool->list = entry;
 
-	pthread_mutex_unlock(&pool->mtx);
+	return data;
+}
+
+void *stfl_ipool_add(struct stfl_ipool *pool, void *data)
+{
+	ipool_lock(pool);
+	ipool_add_locked(pool, data);
+	ipool_unlock(pool);
 
 	return data;
 }
@@ -78,18 +332,26 @@ const wchar_t *stfl_ipool_towc(struct stfl_ipool *pool, const char *buf)
 	if (!pool || !buf)
 		return 0;
 
-	pthread_mutex_lock(&pool->mtx);
+	ipool_lock(pool);
 
 	if (!strcmp("WCHAR_T", pool->code)) {
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return (wchar_t*)buf;
 	}
 
+	if (is_utf8(pool->code)) {
+		size_t len = strlen(buf);
+		wchar_t *buffer = ipool_alloc(pool, (len+1) * sizeof(wchar_t));
+		stfl_utf8_decode(buffer, buf, len);
+		ipool_unlock(pool);
+		return buffer;
+	}
+
 	if (pool->to_wc_desc == (iconv_t)(-1))
 		pool->to_wc_desc = iconv_open("WCHAR_T", pool->code);
 
 	if (pool->to_wc_desc == (iconv_t)(-1)) {
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return 0;
 	}
 
@@ -129,7 +391,7 @@ retry_without_growing:;
 
 	if (rc == -1) {
 		free(buffer);
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return 0;
 	}
 
@@ -137,7 +399,7 @@ retry_without_growing:;
 		buffer = realloc(buffer, buffer_size+sizeof(wchar_t));
 	*((wchar_t*)outbuf) = 0;
 
-	pthread_mutex_unlock(&pool->mtx);
+	ipool_unlock(pool);
 	return stfl_ipool_add(pool, buffer);
 }
 
@@ -146,18 +408,26 @@ const char *stfl_ipool_fromwc(struct stfl_ipool *pool, const wchar_t *buf)
 	if (!pool || !buf)
 		return 0;
 
-	pthread_mutex_lock(&pool->mtx);
+	ipool_lock(pool);
 
 	if (!strcmp("WCHAR_T", pool->code)) {
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return (char*)buf;
 	}
 
+	if (is_utf8(pool->code)) {
+		size_t len = wcslen(buf);
+		char *buffer = ipool_alloc(pool, stfl_utf8_length(buf, len) + 1);
+		stfl_utf8_encode(buffer, buf, len);
+		ipool_unlock(pool);
+		return buffer;
+	}
+
 	if (pool->from_wc_desc == (iconv_t)(-1))
 		pool->from_wc_desc = iconv_open(pool->code, "WCHAR_T");
 
 	if (pool->from_wc_desc == (iconv_t)(-1)) {
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return 0;
 	}
 
@@ -197,7 +467,7 @@ retry_without_growing:;
 
 	if (rc == -1) {
 		free(buffer);
-		pthread_mutex_unlock(&pool->mtx);
+		ipool_unlock(pool);
 		return 0;
 	}
 
@@ -205,7 +475,7 @@ retry_without_growing:;
 		buffer = realloc(buffer, buffer_size+1);
 	*outbuf = 0;
 
-	pthread_mutex_unlock(&pool->mtx);
+	ipool_unlock(pool);
 	return stfl_ipool_add(pool, buffer);
 }
 
@@ -214,25 +484,31 @@ void stfl_ipool_flush(struct stfl_ipool *pool)
 	if (!pool)
 		return;
 
-	pthread_mutex_lock(&pool->mtx);
+	ipool_lock(pool);
 
 	while (pool->list) {
 		struct stfl_ipool_entry *l = pool->list;
 		pool->list = l->next;
 		free(l->data);
-		free(l);
 	}
 
-	pthread_mutex_unlock(&pool->mtx);
+	pool->current = pool->chunks;
+	if (pool->current)
+		pool->current->used = 0;
+
+	ipool_unlock(pool);
 }
 
-void stfl_ipool_destroy(struct stfl_ipool *pool)
+static void ipool_free(struct stfl_ipool *pool)
 {
-	if (!pool)
-		return;
-
 	stfl_ipool_flush(pool);
 
+	while (pool->chunks) {
+		struct stfl_ipool_chunk *c = pool->chunks;
+		pool->chunks = c->next;
+		free(c);
+	}
+
 	free(pool->code);
 
 	if (pool->to_wc_desc != (iconv_t)(-1))
@@ -244,3 +520,53 @@ void stfl_ipool_destroy(struct stfl_ipool *pool)
 	free(pool);
 }
 
+
+void stfl_ipool_destroy(struct stfl_ipool *pool)
+{
+	if (!pool)
+		return;
+
+	/* thread pools live until their thread exits */
+	if (pool->local)
+		stfl_ipool_flush(pool);
+	else
+		ipool_free(pool);
+}
+
+static pthread_key_t local_key;
+static pthread_once_t local_once = PTHREAD_ONCE_INIT;
+
+static void ipool_local_free(void *data)
+{
+	struct stfl_ipool *pool = data;
+
+	while (pool) {
+		struct stfl_ipool *next = pool->next_local;
+		ipool_free(pool);
+		pool = next;
+	}
+}
+
+static void ipool_local_init()
+{
+	pthread_key_create(&local_key, ipool_local_free);
+}
+
+struct stfl_ipool *stfl_ipool_thread(const char *code)
+{
+	struct stfl_ipool *first, *pool;
+
+	pthread_once(&local_once, ipool_local_init);
+	first = pthread_getspecific(local_key);
+
+	for (pool = first; pool; pool = pool->next_local)
+		if (!strcmp(pool->code, code))
+			return pool;
+
+	pool = stfl_ipool_create(code);
+	pool->local = 1;
+	pool->next_local = first;
+	pthread_setspecific(local_key, pool);
+
+	return pool;
+}
@@ -0,0 +1,242 @@
+/*
+ *  STFL - The Structured Terminal Forms Language/Library
+ *  Copyright (C) 2006, 2007  Clifford Wolf <clifford@clifford.at>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *  
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301 USA
+ *
+ *  index.c: Positional index over the children of a widget
+ */
+
+#include "stfl_internals.h"
+
+/*
+ * The children of a widget are kept in the sibling list as usual. Widgets
+ * that need random access by position (list, textview, textedit) ask for
+ * it through stfl_widget_child_at() and friends, which lazily build a
+ * treap over the children, ordered like the sibling list and keyed on the
+ * subtree sizes. Once built, stfl_widget_insert() and stfl_widget_unlink()
+ * keep it up to date in O(log n), so the index is never rebuilt unless
+ * the container runs empty.
+ */
+
+static unsigned int idx_prio(struct stfl_widget *w)
+{
+	unsigned int x = w->id * 2654435761U;
+	x ^= x >> 16;
+	x *= 0x45d9f3bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static int idx_size(struct stfl_widget *w)
+{
+	return w ? w->idx_size : 0;
+}
+
+static void idx_update(struct stfl_widget *w)
+{
+	w->idx_size = 1 + idx_size(w->idx_left) + idx_size(w->idx_right);
+}
+
+static void idx_replace(struct stfl_widget *parent, struct stfl_widget *old, struct stfl_widget *new)
+{
+	struct stfl_widget *p = old->idx_parent;
+
+	if (new)
+		new->idx_parent = p;
+
+	if (!p)
+		parent->idx_root = new;
+	else if (p->idx_left == old)
+		p->idx_left = new;
+	else
+		p->idx_right = new;
+}
+
+/* rotate c up one level, taking the place of its tree parent */
+static void idx_rotate_up(struct stfl_widget *parent, struct stfl_widget *c)
+{
+	struct stfl_widget *p = c->idx_parent;
+
+	idx_replace(parent, p, c);
+
+	if (p->idx_left == c) {
+		p->idx_left = c->idx_right;
+		if (p->idx_left)
+			p->idx_left->idx_parent = p;
+		c->idx_right = p;
+	} else {
+		p->idx_right = c->idx_left;
+		if (p->idx_right)
+			p->idx_right->idx_parent = p;
+		c->idx_left = p;
+	}
+
+	p->idx_parent = c;
+	idx_update(p);
+	idx_update(c);
+}
+
+static int idx_build_sizes(struct stfl_widget *w)
+{
+	if (!w)
+		return 0;
+	w->idx_size = 1 + idx_build_sizes(w->idx_left) + idx_build_sizes(w->idx_right);
+	return w->idx_size;
+}
+
+/* build the whole tree in one pass, using the right spine as a stack */
+static void idx_build(struct stfl_widget *w)
+{
+	struct stfl_widget *top = 0, *c;
+
+	w->idx_root = 0;
+
+	for (c = w->first_child; c; c = c->next_sibling)
+	{
+		struct stfl_widget *popped = 0;
+
+		c->idx_prio = idx_prio(c);
+
+		while (top && top->idx_prio < c->idx_prio) {
+			popped = top;
+			top = top->idx_parent;
+		}
+
+		c->idx_left = popped;
+		c->idx_right = 0;
+		c->idx_parent = top;
+
+		if (popped)
+			popped->idx_parent = c;
+
+		if (top)
+			top->idx_right = c;
+		else
+			w->idx_root = c;
+
+		top = c;
+	}
+
+	idx_build_sizes(w->idx_root);
+}
+
+void stfl_index_insert(struct stfl_widget *parent, struct stfl_widget *first, struct stfl_widget *next)
+{
+	struct stfl_widget *c, *p;
+
+	if (!parent->idx_root)
+		return;
+
+	for (c = first; c != next; c = c->next_sibling)
+	{
+		struct stfl_widget *prev = c->prev_sibling;
+
+		c->idx_prio = idx_prio(c);
+		c->idx_left = c->idx_right = 0;
+		c->idx_size = 1;
+
+		if (prev && !prev->idx_right) {
+			prev->idx_right = c;
+			c->idx_parent = prev;
+		} else {
+			next->idx_left = c;
+			c->idx_parent = next;
+		}
+
+		for (p = c->idx_parent; p; p = p->idx_parent)
+			p->idx_size++;
+
+		while (c->idx_parent && c->idx_parent->idx_prio < c->idx_prio)
+			idx_rotate_up(parent, c);
+	}
+}
+
+void stfl_index_remove(struct stfl_widget *parent, struct stfl_widget *c)
+{
+	struct stfl_widget *p;
+
+	if (!parent->idx_root)
+		return;
+
+	while (c->idx_left && c->idx_right) {
+		if (c->idx_left->idx_prio > c->idx_right->idx_prio)
+			idx_rotate_up(parent, c->idx_left);
+		else
+			idx_rotate_up(parent, c->idx_right);
+	}
+
+	p = c->idx_parent;
+	idx_replace(parent, c, c->idx_left ? c->idx_left : c->idx_right);
+
+	for (; p; p = p->idx_parent)
+		p->idx_size--;
+
+	c->idx_parent = c->idx_left = c->idx_right = 0;
+}
+
+int stfl_widget_child_count(struct stfl_widget *w)
+{
+	if (!w->idx_root && w->first_child)
+		idx_build(w);
+	return idx_size(w->idx_root);
+}
+
+struct stfl_widget *stfl_widget_child_at(struct stfl_widget *w, int pos)
+{
+	struct stfl_widget *c;
+
+	if (!w->idx_root && w->first_child)
+		idx_build(w);
+
+	c = w->idx_root;
+	if (pos < 0 || pos >= idx_size(c))
+		return 0;
+
+	while (c) {
+		int left = idx_size(c->idx_left);
+		if (pos < left) {
+			c = c->idx_left;
+		} else if (pos == left) {
+			return c;
+		} else {
+			pos -= left + 1;
+			c = c->idx_right;
+		}
+	}
+
+	return 0;
+}
+
+int stfl_widget_child_pos(struct stfl_widget *c)
+{
+	struct stfl_widget *p;
+	int pos;
+
+	if (!c->parent)
+		return -1;
+
+	if (!c->parent->idx_root)
+		idx_build(c->parent);
+
+	pos = idx_size(c->idx_left);
+	for (p = c->idx_parent; p; c = p, p = p->idx_parent)
+		if (p->idx_right == c)
+			pos += idx_size(p->idx_left) + 1;
+
+	return pos;
+}
+
@@ -26,213 +26,277 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
-
-#define MYWCSCSPN_SKIP_QUOTED	0x01
-#define MYWCSCSPN_SKIP_NAMES	0x02
-
-static size_t mywcscspn(const wchar_t *wcs, const wchar_t *reject, int flags)
+#include <sys/stat.h>
+
+/* characters the tokenizer has to look at, everything else is copied as is */
+#define CC_SPECIAL	0x01
+#define CC_KEY_END	0x02
+#define CC_VALUE_END	0x04
+
+#define CC_BLANK	(CC_SPECIAL|CC_KEY_END|CC_VALUE_END)
+
+static const unsigned char char_class[128] = {
+	[0]     = CC_BLANK,
+	[L' ']  = CC_BLANK,
+	[L'\t'] = CC_BLANK,
+	[L'\r'] = CC_BLANK,
+	[L'\n'] = CC_BLANK,
+	[L'{']  = CC_BLANK,
+	[L'}']  = CC_BLANK,
+	[L':']  = CC_SPECIAL|CC_KEY_END,
+	[L'\''] = CC_SPECIAL,
+	[L'\"'] = CC_SPECIAL,
+	[L'[']  = CC_SPECIAL,
+	[L']']  = CC_SPECIAL,
+	[L'#']  = CC_SPECIAL,
+};
+
+#define CCLASS(c) ((unsigned int)(c) < 128 ? char_class[(c)] : 0)
+
+/* scratch buffer for the type and key/value strings of the current line */
+struct parser_buf {
+	wchar_t *data;
+	int size;
+};
+
+static void buf_reserve(struct parser_buf *b, int len)
 {
-	enum {
-		PLAIN,
-		NAME_BLOCK,
-		SINGLE_QUOTE,
-		SINGLE_QUOTE_NAME,
-		DOUBLE_QUOTE,
-		DOUBLE_QUOTE_NAME,
-	} state = PLAIN;
-
-	int len = 0;
-	int i;
-
-	while (1)
-	{
-		if (!wcs[len])
-			return len;
-
-		switch (state)
-		{
-		case PLAIN:
-			if ((flags & MYWCSCSPN_SKIP_NAMES) && (wcs[len] == L'[')) {
-				state = NAME_BLOCK;
-				break;
-			}
-			if ((flags & MYWCSCSPN_SKIP_QUOTED) && (wcs[len] == L'\'')) {
-				state = SINGLE_QUOTE;
-				break;
-			}
-			if ((flags & MYWCSCSPN_SKIP_QUOTED) && (wcs[len] == L'\"')) {
-				state = DOUBLE_QUOTE;
-				break;
-			}
-			for (i=0; reject[i]; i++)
-				if (wcs[len] == reject[i])
-					return len;
-			break;
-		case NAME_BLOCK:
-			if ((flags & MYWCSCSPN_SKIP_QUOTED) && (wcs[len] == L'\'')) {
-				state = SINGLE_QUOTE_NAME;
-				break;
-			}
-			if ((flags & MYWCSCSPN_SKIP_QUOTED) && (wcs[len] == L'\"')) {
-				state = DOUBLE_QUOTE_NAME;
-				break;
-			}
-			if (wcs[len] == L']')
-				state = PLAIN;
-			break;
-		case SINGLE_QUOTE:
-		case SINGLE_QUOTE_NAME:
-			if (wcs[len] == L'\'')
-				state = state == SINGLE_QUOTE ? PLAIN : NAME_BLOCK;
-			break;
-		case DOUBLE_QUOTE:
-		case DOUBLE_QUOTE_NAME:
-			if (wcs[len] == L'\"')
-				state = state == DOUBLE_QUOTE ? PLAIN : NAME_BLOCK;
-			break;
-		}
+	if (len <= b->size)
+		return;
 
-		len++;
-	}
+	b->size = len * 2 + 256;
+	b->data = realloc(b->data, b->size * sizeof(wchar_t));
 }
 
-static wchar_t *unquote(const wchar_t *text, int tlen)
+/*
+ * Find the end of a type or key: the next blank, brace or ':' which is not
+ * quoted or inside a [name]. Also report the first '[' and the first '#'
+ * before it, as the name and class are split off at those.
+ */
+static int scan_key(const wchar_t *text, int *brk, int *hash)
 {
-	int len_v = 0, i, j;
-	wchar_t *value;
+	wchar_t c, quote = 0;
+	int len, in_name = 0;
 
-	if (!text)
-		return 0;
+	*brk = *hash = -1;
 
-	for (i=0; (i<tlen || tlen<0) && text[i]; i++)
+	for (len = 0; ; len++)
 	{
-		if (text[i] == L'\'')
-			while (1) {
-				if (++i == tlen && tlen >= 0)
-					goto finish_len_v_loop;
-				if (!text[i] || text[i] == L'\'') break;
-				len_v++;
-			}
-		else
-		if (text[i] == L'\"')
-			while (1) {
-				if (++i == tlen && tlen >= 0)
-					goto finish_len_v_loop;
-				if (!text[i] || text[i] == L'\"') break;
-				len_v++;
-			}
-		else
-			len_v++;
-finish_len_v_loop:;
-	}
+		c = text[len];
 
-	value = malloc(sizeof(wchar_t)*(len_v+1));
+		if (!(CCLASS(c) & CC_SPECIAL))
+			continue;
+		if (!c)
+			break;
 
-	for (i=j=0; (i<tlen || tlen<0) && text[i]; i++)
-	{
-		if (text[i] == L'\'')
-			while (1) {
-				if (++i == tlen && tlen >= 0)
-					goto finish_copy_loop;
-				if (!text[i] || text[i] == L'\'') break;
-				value[j++] = text[i];
-			}
+		if (c == L'[' && *brk < 0)
+			*brk = len;
+		if (c == L'#' && *brk < 0 && *hash < 0)
+			*hash = len;
+
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+		} else
+		if (c == L'\'' || c == L'\"')
+			quote = c;
 		else
-		if (text[i] == L'\"')
-			while (1) {
-				if (++i == tlen && tlen >= 0)
-					goto finish_copy_loop;
-				if (!text[i] || text[i] == L'\"') break;
-				value[j++] = text[i];
-			}
+		if (in_name)
+			in_name = c != L']';
 		else
-			value[j++] = text[i];
-finish_copy_loop:;
+		if (c == L'[')
+			in_name = 1;
+		else
+		if (CCLASS(c) & CC_KEY_END)
+			break;
 	}
 
-	value[j] = 0;
-	assert(j == len_v);
-
-	return value;
+	return len;
 }
 
-static void extract_name(wchar_t **key, wchar_t **name)
+/* copy len characters from text to dst, dropping the quotes */
+static int unquote(wchar_t *dst, const wchar_t *text, int len)
 {
-	int len = wcscspn(*key, L"[");
+	wchar_t c, quote = 0;
+	int i, j;
 
-	if ((*key)[len] == 0) {
-		*name = 0;
-		return;
-	}
+	for (i=j=0; i<len; i++)
+	{
+		c = text[i];
 
-	*name = compat_wcsdup(*key+len+1);
-	*key = realloc(*key, sizeof(wchar_t)*(len+1));
-	(*key)[len] = 0;
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+			else
+				dst[j++] = c;
+		} else
+		if (c == L'\'' || c == L'\"')
+			quote = c;
+		else
+			dst[j++] = c;
+	}
 
-	len = mywcscspn(*name, L"]", MYWCSCSPN_SKIP_QUOTED);
-	(*name)[len] = 0;
+	dst[j] = 0;
+	return j;
 }
 
-static void extract_class(wchar_t **key, wchar_t **cls)
+/* the name runs from the first '[' of the token to the next unquoted ']' */
+static wchar_t *read_name(const wchar_t *text, int brk, int len)
 {
-	int len = wcscspn(*key, L"#");
+	wchar_t quote = 0;
+	int i;
 
-	if ((*key)[len] == 0) {
-		*cls = 0;
-		return;
+	if (brk < 0)
+		return 0;
+
+	for (i=brk+1; i<len; i++) {
+		if (quote) {
+			if (text[i] == quote)
+				quote = 0;
+		} else
+		if (text[i] == L'\'' || text[i] == L'\"')
+			quote = text[i];
+		else
+		if (text[i] == L']')
+			break;
 	}
 
-	*cls = compat_wcsdup(*key+len+1);
-	*key = realloc(*key, sizeof(wchar_t)*(len+1));
-	(*key)[len] = 0;
+	wchar_t *name = malloc(sizeof(wchar_t)*(i-brk));
+	unquote(name, text+brk+1, i-brk-1);
+	return name;
 }
 
-static int read_type(const wchar_t **text, wchar_t **type, wchar_t **name, wchar_t **cls)
+static int read_type(const wchar_t **text, struct parser_buf *b, wchar_t **type, wchar_t **name, wchar_t **cls)
 {
-	int len = mywcscspn(*text, L" \t\r\n:{}", MYWCSCSPN_SKIP_QUOTED|MYWCSCSPN_SKIP_NAMES);
+	int brk, hash;
+	int len = scan_key(*text, &brk, &hash);
 
 	if ((*text)[len] == L':' || len == 0)
 		return 0;
 
-	*type = malloc((len+1)*sizeof(wchar_t));
-	wmemcpy(*type, *text, len);
-	(*type)[len] = 0;
-	*text += len;
+	int key_len = brk >= 0 ? brk : len;
+	int type_len = hash >= 0 ? hash : key_len;
+
+	buf_reserve(b, type_len+1);
+	wmemcpy(b->data, *text, type_len);
+	b->data[type_len] = 0;
+	*type = b->data;
+
+	*cls = 0;
+	if (hash >= 0) {
+		*cls = malloc(sizeof(wchar_t)*(key_len-hash));
+		wmemcpy(*cls, *text+hash+1, key_len-hash-1);
+		(*cls)[key_len-hash-1] = 0;
+	}
 
-	extract_name(type, name);
-	extract_class(type, cls);
+	*name = read_name(*text, brk, len);
+	*text += len;
 
 	return 1;
 }
 
-static int read_kv(const wchar_t **text, wchar_t **key, wchar_t **name, wchar_t **value)
+static int read_kv(const wchar_t **text, struct parser_buf *b, wchar_t **key, wchar_t **name, wchar_t **value)
 {
-	int len_k = mywcscspn(*text, L" \t\r\n:{}", MYWCSCSPN_SKIP_QUOTED|MYWCSCSPN_SKIP_NAMES);
+	int brk, hash;
+	int len_k = scan_key(*text, &brk, &hash);
 
 	if ((*text)[len_k] != L':' || len_k == 0)
 		return 0;
 
-	*key = malloc((len_k+1)*sizeof(wchar_t));
-	wmemcpy(*key, *text, len_k);
-	(*key)[len_k] = 0;
-	*text += len_k+1;
+	int key_len = brk >= 0 ? brk : len_k;
+	const wchar_t *p = *text + len_k + 1;
+	wchar_t c, quote = 0;
+	int pos = key_len + 1;
+
+	buf_reserve(b, pos + 64);
+	wmemcpy(b->data, *text, key_len);
+	b->data[key_len] = 0;
 
-	extract_name(key, name);
+	/* the value is unquoted into the buffer while looking for its end */
+	for (;; p++)
+	{
+		if (pos+1 >= b->size)
+			buf_reserve(b, pos+2);
+
+		c = *p;
+
+		if (CCLASS(c) & CC_SPECIAL) {
+			if (!c)
+				break;
+			if (quote) {
+				if (c == quote) {
+					quote = 0;
+					continue;
+				}
+			} else
+			if (c == L'\'' || c == L'\"') {
+				quote = c;
+				continue;
+			} else
+			if (CCLASS(c) & CC_VALUE_END)
+				break;
+		}
+
+		b->data[pos++] = c;
+	}
 
-	int qval_len = mywcscspn(*text, L" \t\r\n{}", MYWCSCSPN_SKIP_QUOTED);
-	*value = unquote(*text, qval_len);
-	*text += qval_len;
+	b->data[pos] = 0;
+	*key = b->data;
+	*value = b->data + key_len + 1;
+	*name = read_name(*text, brk, len_k);
+	*text = p;
 
 	return 1;
 }
 
-struct stfl_widget *stfl_parser(const wchar_t *text)
+/* report a syntax error at text, with line and column counted from start */
+static void report_error(const wchar_t *start, const wchar_t *text, const char *filename)
+{
+	int size = 160 + (filename ? strlen(filename) : 0);
+	wchar_t context[20*4+1], message[size];
+	int line = 1, column = 1;
+	int i, j;
+
+	for (; start < text; start++) {
+		column++;
+		if (*start == L'\n')
+			line++, column = 1;
+	}
+
+	for (i=j=0; text[i] && i<20; i++)
+		if (text[i] == L'\n')
+			j += swprintf(context+j, 3, L"\\n");
+		else
+		if (text[i] == L'\t')
+			context[j++] = L' ';
+		else
+		if (text[i] < 32)
+			j += swprintf(context+j, 5, L"\\%03lo", (long unsigned int)text[i]);
+		else
+			context[j++] = text[i];
+	context[j] = 0;
+
+	if (filename)
+		swprintf(message, size, L"STFL Parser Error near '%ls' in file '%s', line %d, column %d.",
+				context, filename, line, column);
+	else
+		swprintf(message, size, L"STFL Parser Error near '%ls' in line %d, column %d.",
+				context, line, column);
+
+	stfl_error_report(message, line, column);
+}
+
+struct include_deps;
+static struct stfl_widget *include_file(const char *filename, struct include_deps *parent);
+
+static struct stfl_widget *parse(const wchar_t *text, const char *filename, struct include_deps *deps)
 {
+	const wchar_t *start = text;
 	struct stfl_widget *root = 0;
 	struct stfl_widget *current = 0;
 	int bracket_indenting = -1;
 	int bracket_level = 0;
+	struct parser_buf buf = { 0, 0 };
 
 	while (1)
 	{
@@ -314,32 +378,30 @@ struct stfl_widget *stfl_parser(const wchar_t *text)
 			wfn[filename_len] = 0;
 
 			size_t len = wcstombs(NULL,wfn,0)+1;
-			char filename[len];
-			size_t rc = wcstombs(filename, wfn, len);
-			assert(rc != (size_t)-1);
+			if (len == 0)
+				goto parser_error;
+
+			char include[len];
+			wcstombs(include, wfn, len);
 
 			text += filename_len;
 			if (*text) text++;
 
-			struct stfl_widget *n = stfl_parser_file(filename);
-			if (!n) return 0;
+			struct stfl_widget *n = include_file(include, deps);
+			if (!n)
+				goto included_error;
 
 			if (root)
 			{
 				while (current->parser_indent >= indenting) {
 					current = current->parent;
-					if (!current)
+					if (!current) {
+						stfl_widget_free(n);
 						goto parser_error;
+					}
 				}
 
-				n->parent = current;
-				if (current->last_child) {
-					current->last_child->next_sibling = n;
-					current->last_child = n;
-				} else {
-					current->first_child = n;
-					current->last_child = n;
-				}
+				stfl_widget_insert(current, 0, n);
 
 				n->parser_indent = indenting;
 				current = n;
@@ -356,57 +418,54 @@ struct stfl_widget *stfl_parser(const wchar_t *text)
 					goto parser_error;
 			}
 
-			if (read_type(&text, &key, &name, &cls) == 1)
+			const wchar_t *token = text;
+
+			if (read_type(&text, &buf, &key, &name, &cls) == 1)
 			{
 				struct stfl_widget *n = stfl_widget_new(key);
-				if (!n)
+				if (!n) {
+					free(name);
+					free(cls);
+					text = token;
 					goto parser_error;
-				free(key);
-
-				n->parent = current;
-				if (current->last_child) {
-					current->last_child->next_sibling = n;
-					current->last_child = n;
-				} else {
-					current->first_child = n;
-					current->last_child = n;
 				}
 
+				stfl_widget_insert(current, 0, n);
+
 				n->parser_indent = indenting;
-				n->name = unquote(name, -1);
-				free(name);
+				n->name = name;
 				n->cls = cls;
 				current = n;
 			}
 			else
-			if (read_kv(&text, &key, &name, &value) == 1)
+			if (read_kv(&text, &buf, &key, &name, &value) == 1)
 			{
 				struct stfl_kv *kv = stfl_widget_setkv_str(current, key, value);
 				if (kv->name)
 					free(kv->name);
-				kv->name = unquote(name, -1);
-				free(name);
-
-				free(key);
-				free(value);
+				kv->name = name;
 			}
 			else
 				goto parser_error;
 		}
 		else
 		{
-			if (read_type(&text, &key, &name, &cls) == 0)
+			const wchar_t *token = text;
+
+			if (read_type(&text, &buf, &key, &name, &cls) == 0)
 				goto parser_error;
 
 			struct stfl_widget *n = stfl_widget_new(key);
-			if (!n)
+			if (!n) {
+				free(name);
+				free(cls);
+				text = token;
 				goto parser_error;
-			free(key);
+			}
 
 			root = n;
 			current = n;
-			n->name = unquote(name, -1);
-			free(name);
+			n->name = name;
 			n->cls = cls;
 		}
 
@@ -417,54 +476,46 @@ struct stfl_widget *stfl_parser(const wchar_t *text)
 
 			if (*text && *text != L'\n' && *text != L'\r' && *text != L'{' && *text != L'}')
 			{
-				if (read_kv(&text, &key, &name, &value) == 0)
+				if (read_kv(&text, &buf, &key, &name, &value) == 0)
 					goto parser_error;
 
 				struct stfl_kv *kv = stfl_widget_setkv_str(current, key, value);
 				if (kv->name)
 					free(kv->name);
-				kv->name = unquote(name, -1);
-				free(name);
-
-				free(key);
-				free(value);
+				kv->name = name;
 			}
 		}
 	}
 
-	if (root)
+	if (root) {
+		free(buf.data);
 		return root;
+	}
 
-parser_error:;
-	int i;
-
-	fprintf(stderr, "STFL Parser Error near '");
-
-	for (i=0; *text && i<20; i++, text++)
-		if (*text == L'\n')
-			fprintf(stderr, "\\n");
-		else
-		if (*text == L'\t')
-			fprintf(stderr, " ");
-		else
-		if (*text < 32)
-			fprintf(stderr, "\\%03lo", (long unsigned int)*text);
-		else
-			fprintf(stderr, "%lc", (wint_t)*text);
-
-	fprintf(stderr, "'.\r\n");
-	abort();
+parser_error:
+	report_error(start, text, filename);
 
+included_error:
+	if (root)
+		stfl_widget_free(root);
+	free(buf.data);
 	return 0;
 }
 
-struct stfl_widget *stfl_parser_file(const char *filename)
+/* parse STFL code, returns 0 and reports the error if the code is broken */
+struct stfl_widget *stfl_parser(const wchar_t *text)
+{
+	return parse(text, 0, 0);
+}
+
+static struct stfl_widget *read_file(const char *filename, struct include_deps *deps)
 {
 	FILE *f = fopen(filename, "r");
 
 	if (!f) {
-		fprintf(stderr, "STFL Parser Error: Can't read file '%s'!\n", filename);
-		abort();
+		wchar_t message[strlen(filename)+64];
+		swprintf(message, strlen(filename)+64, L"STFL Parser Error: Can't read file '%s'!", filename);
+		stfl_error_report(message, 0, 0);
 		return 0;
 	}
 
@@ -484,10 +535,17 @@ struct stfl_widget *stfl_parser_file(const char *filename)
 
 	const char * text1 = text;
 	size_t wtextsize = mbsrtowcs(NULL,&text1,strlen(text1)+1,NULL)+1;
-	wchar_t * wtext = malloc(sizeof(wchar_t)*wtextsize);
 
-	size_t rc = mbstowcs(wtext, text, wtextsize);
-	assert(rc != (size_t)-1);
+	if (wtextsize == 0) {
+		wchar_t message[strlen(filename)+64];
+		swprintf(message, strlen(filename)+64, L"STFL Parser Error: Invalid multibyte sequence in file '%s'!", filename);
+		stfl_error_report(message, 0, 0);
+		free(text);
+		return 0;
+	}
+
+	wchar_t * wtext = malloc(sizeof(wchar_t)*wtextsize);
+	mbstowcs(wtext, text, wtextsize);
 
 #if 0
 	fprintf(stderr,"strlen(text) = %u wcslen(wtext) = %u rc = %u wtextsize = %u\n", strlen(text), wcslen(wtext), rc, wtextsize);
@@ -496,10 +554,222 @@ struct stfl_widget *stfl_parser_file(const char *filename)
 	fprintf(stderr,"converted: `%ls'\n", wtext);
 #endif
 
-	struct stfl_widget *w = stfl_parser(wtext);
+	struct stfl_widget *w = parse(wtext, filename, deps);
 	free(text);
 	free(wtext);
 
 	return w;
 }
 
+
+/*
+ * Included files are parsed once and kept here, together with the stat data
+ * of the file and of all files it includes. Each include gets its own copy of
+ * the tree as long as none of these files has changed. The cached trees are
+ * templates outside of the widget id index, and only the INCLUDE_CACHE_MAX
+ * most recently used files are kept.
+ */
+
+#define INCLUDE_CACHE_MAX 64
+
+struct include_stat {
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct include_deps {
+	struct include_stat *files;
+	int count, alloc;
+};
+
+struct include_entry {
+	struct include_entry *next;
+	struct include_deps deps;
+	struct stfl_widget *tree;
+};
+
+static struct include_entry *include_cache = 0;
+static int include_count = 0;
+static pthread_mutex_t include_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void deps_add(struct include_deps *d, const char *filename, struct stat *st)
+{
+	if (d->count == d->alloc) {
+		d->alloc = d->alloc * 2 + 4;
+		d->files = realloc(d->files, d->alloc * sizeof(struct include_stat));
+	}
+
+	struct include_stat *s = &d->files[d->count++];
+	s->filename = strdup(filename);
+	s->dev = st->st_dev;
+	s->ino = st->st_ino;
+	s->size = st->st_size;
+	s->mtime = st->st_mtim;
+}
+
+static void deps_add_all(struct include_deps *d, struct include_deps *from)
+{
+	int i;
+
+	for (i=0; i<from->count; i++) {
+		struct include_stat *s = &from->files[i];
+		struct stat st;
+
+		st.st_dev = s->dev;
+		st.st_ino = s->ino;
+		st.st_size = s->size;
+		st.st_mtim = s->mtime;
+		deps_add(d, s->filename, &st);
+	}
+}
+
+static void deps_free(struct include_deps *d)
+{
+	int i;
+
+	for (i=0; i<d->count; i++)
+		free(d->files[i].filename);
+	free(d->files);
+}
+
+static int deps_unchanged(struct include_deps *d)
+{
+	struct stat st;
+	int i;
+
+	for (i=0; i<d->count; i++) {
+		struct include_stat *s = &d->files[i];
+		if (stat(s->filename, &st) < 0 || s->dev != st.st_dev || s->ino != st.st_ino || s->size != st.st_size ||
+				s->mtime.tv_sec != st.st_mtim.tv_sec || s->mtime.tv_nsec != st.st_mtim.tv_nsec)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* find the entry for filename and move it to the front of the cache */
+static struct include_entry *include_lookup(const char *filename)
+{
+	struct include_entry **ep, *e;
+
+	for (ep = &include_cache; (e = *ep) != 0; ep = &e->next)
+		if (!strcmp(e->deps.files[0].filename, filename)) {
+			*ep = e->next;
+			e->next = include_cache;
+			include_cache = e;
+			break;
+		}
+
+	return e;
+}
+
+/* drop the least recently used entry, which is the last one */
+static void include_evict()
+{
+	struct include_entry **ep = &include_cache, *e;
+
+	while ((*ep)->next)
+		ep = &(*ep)->next;
+
+	e = *ep;
+	*ep = 0;
+	include_count--;
+
+	deps_free(&e->deps);
+	stfl_widget_free(e->tree);
+	free(e);
+}
+
+/* parse an included file, the files it depends on are added to parent */
+static struct stfl_widget *include_file(const char *filename, struct include_deps *parent)
+{
+	struct include_deps deps = { 0, 0, 0 };
+	struct include_entry *e;
+	struct stfl_widget *w;
+	struct stat st;
+
+	if (stat(filename, &st) < 0)
+		return read_file(filename, 0);
+
+	pthread_mutex_lock(&include_mtx);
+	e = include_lookup(filename);
+	if (e && deps_unchanged(&e->deps)) {
+		w = stfl_widget_clone(e->tree, 0);
+		if (parent)
+			deps_add_all(parent, &e->deps);
+		pthread_mutex_unlock(&include_mtx);
+		return w;
+	}
+	pthread_mutex_unlock(&include_mtx);
+
+	deps_add(&deps, filename, &st);
+	w = read_file(filename, &deps);
+
+	if (!w) {
+		deps_free(&deps);
+		return 0;
+	}
+
+	if (parent)
+		deps_add_all(parent, &deps);
+
+	pthread_mutex_lock(&include_mtx);
+	e = include_lookup(filename);
+	if (e) {
+		deps_free(&e->deps);
+		stfl_widget_free(e->tree);
+	} else {
+		if (include_count == INCLUDE_CACHE_MAX)
+			include_evict();
+		e = calloc(1, sizeof(struct include_entry));
+		e->next = include_cache;
+		include_cache = e;
+		include_count++;
+	}
+	e->deps = deps;
+	e->tree = stfl_widget_template(w);
+	pthread_mutex_unlock(&include_mtx);
+
+	return w;
+}
+
+struct stfl_widget *stfl_parser_file(const char *filename)
+{
+	return include_file(filename, 0);
+}
+
+/* make a vbox with one listitem per line of text, the newlines in text are overwritten */
+struct stfl_widget *stfl_parser_lines(wchar_t *text)
+{
+	struct stfl_widget *root = stfl_widget_new(L"vbox");
+	struct stfl_widget *first = 0, *last = 0;
+
+	while (*text)
+	{
+		wchar_t *eol = wcschr(text, L'\n');
+		wchar_t *next = eol ? eol + 1 : text + wcslen(text);
+
+		if (eol) {
+			if (eol > text && eol[-1] == L'\r')
+				eol--;
+			*eol = 0;
+		}
+
+		struct stfl_widget *c = stfl_widget_new(L"listitem");
+		stfl_widget_setkv_str(c, L"text", text);
+
+		if (last)
+			last->next_sibling = c;
+		else
+			first = c;
+		last = c;
+
+		text = next;
+	}
+
+	stfl_widget_insert(root, 0, first);
+	return root;
+}
@@ -21,6 +21,7 @@
  */
 
 #include "stfl_internals.h"
+#include "stfl_compat.h"
 
 #include <pthread.h>
 #include <stdlib.h>
@@ -30,6 +31,54 @@
 
 int stfl_api_allow_null_pointers = 1;
 
+static pthread_key_t pseudovar_key;
+
+static void pseudovar_key_init()
+{
+	pthread_key_create(&pseudovar_key, free);
+}
+
+static enum {
+	ERROR_ABORT,
+	ERROR_EXIT,
+	ERROR_PRINT,
+	ERROR_NONE,
+} error_action = ERROR_ABORT;
+
+/* the last error of the calling thread */
+struct stfl_error_info {
+	wchar_t *message;
+	int line, column;
+};
+
+static pthread_key_t error_key;
+
+static void error_info_free(void *data)
+{
+	struct stfl_error_info *e = data;
+	free(e->message);
+	free(e);
+}
+
+static void error_key_init()
+{
+	pthread_key_create(&error_key, error_info_free);
+}
+
+static struct stfl_error_info *error_info()
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	struct stfl_error_info *e;
+
+	pthread_once(&once, error_key_init);
+	e = pthread_getspecific(error_key);
+	if (!e) {
+		e = calloc(1, sizeof(struct stfl_error_info));
+		pthread_setspecific(error_key, e);
+	}
+	return e;
+}
+
 static const wchar_t *checkret(const wchar_t *txt)
 {
 	if (!stfl_api_allow_null_pointers && !txt)
@@ -39,15 +88,25 @@ static const wchar_t *checkret(const wchar_t *txt)
 
 struct stfl_form *stfl_create(const wchar_t *text)
 {
-	struct stfl_form *f = stfl_form_new();
-	f->root = stfl_parser(text ? text : L"");
+	struct stfl_widget *root;
+	struct stfl_form *f;
+
+	stfl_error_clear();
+	root = stfl_parser(text ? text : L"");
+
+	if (!root)
+		return 0;
+
+	f = stfl_form_new();
+	f->root = root;
 	stfl_check_setfocus(f, f->root);
 	return f;
 }
 
 void stfl_free(struct stfl_form *f)
 {
-	stfl_form_free(f);
+	if (f)
+		stfl_form_free(f);
 }
 
 void stfl_redraw()
@@ -66,66 +125,119 @@ void stfl_reset()
 	stfl_form_reset();
 }
 
-const wchar_t *stfl_get(struct stfl_form *f, const wchar_t *name)
+/* resolve the "widget:x" style pseudo variables, returns 0 for anything else */
+static int stfl_get_pseudovar(struct stfl_form *f, const wchar_t *name, int *value)
 {
 	wchar_t *pseudovar_sep = name ? wcschr(name, L':') : 0;
 
-	pthread_mutex_lock(&f->mtx);
+	if (!pseudovar_sep)
+		return 0;
+
+	wchar_t w_name[pseudovar_sep-name+1];
+	wmemcpy(w_name, name, pseudovar_sep-name);
+	w_name[pseudovar_sep-name] = 0;
+
+	struct stfl_widget *w = stfl_form_widget_by_name(f, w_name);
+	const wchar_t *var = pseudovar_sep+1;
+
+	if (w == 0)
+		return 0;
+
+	if (!wcscmp(var, L"x"))
+		*value = w->x;
+	else if (!wcscmp(var, L"y"))
+		*value = w->y;
+	else if (!wcscmp(var, L"w"))
+		*value = w->w;
+	else if (!wcscmp(var, L"h"))
+		*value = w->h;
+	else if (!wcscmp(var, L"minw"))
+		*value = w->min_w;
+	else if (!wcscmp(var, L"minh"))
+		*value = w->min_h;
+	else
+		return 0;
 
-	if (pseudovar_sep)
-	{
-		wchar_t w_name[pseudovar_sep-name+1];
-		wmemcpy(w_name, name, pseudovar_sep-name);
-		w_name[pseudovar_sep-name] = 0;
+	return 1;
+}
 
-		struct stfl_widget *w = stfl_widget_by_name(f->root, w_name);
-		static wchar_t ret_buffer[16];
+const wchar_t *stfl_get(struct stfl_form *f, const wchar_t *name)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	const wchar_t *tmpstr;
+	int value;
 
-		if (w == 0)
-			goto this_is_not_a_pseudo_var;
+	pthread_mutex_lock(&f->mtx);
 
-		if (!wcscmp(pseudovar_sep+1, L"x")) {
-			swprintf(ret_buffer, 16, L"%d", w->x);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
-		}
-		if (!wcscmp(pseudovar_sep+1, L"y")) {
-			swprintf(ret_buffer, 16, L"%d", w->y);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
-		}
-		if (!wcscmp(pseudovar_sep+1, L"w")) {
-			swprintf(ret_buffer, 16, L"%d", w->w);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
-		}
-		if (!wcscmp(pseudovar_sep+1, L"h")) {
-			swprintf(ret_buffer, 16, L"%d", w->h);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
-		}
-		if (!wcscmp(pseudovar_sep+1, L"minw")) {
-			swprintf(ret_buffer, 16, L"%d", w->min_w);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
-		}
-		if (!wcscmp(pseudovar_sep+1, L"minh")) {
-			swprintf(ret_buffer, 16, L"%d", w->min_h);
-			pthread_mutex_unlock(&f->mtx);
-			return checkret(ret_buffer);
+	if (stfl_get_pseudovar(f, name, &value))
+	{
+		wchar_t *ret_buffer;
+
+		pthread_once(&once, pseudovar_key_init);
+		ret_buffer = pthread_getspecific(pseudovar_key);
+		if (!ret_buffer) {
+			ret_buffer = malloc(16 * sizeof(wchar_t));
+			pthread_setspecific(pseudovar_key, ret_buffer);
 		}
+
+		swprintf(ret_buffer, 16, L"%d", value);
+		pthread_mutex_unlock(&f->mtx);
+		return checkret(ret_buffer);
 	}
 
-this_is_not_a_pseudo_var:;
-	const wchar_t * tmpstr = stfl_getkv_by_name_str(f->root, name ? name : L"", 0);
+	struct stfl_kv *kv = stfl_form_kv_by_name(f, name ? name : L"");
+	tmpstr = kv ? kv->value : 0;
 	pthread_mutex_unlock(&f->mtx);
 	return checkret(tmpstr);
 }
 
+int stfl_get_int(struct stfl_form *f, const wchar_t *name, int defval)
+{
+	struct stfl_kv *kv;
+	wchar_t *end;
+	int value;
+
+	pthread_mutex_lock(&f->mtx);
+
+	if (!stfl_get_pseudovar(f, name, &value)) {
+		kv = stfl_form_kv_by_name(f, name ? name : L"");
+		value = kv ? wcstol(kv->value, &end, 10) : defval;
+		if (kv && end == kv->value)
+			value = defval;
+	}
+
+	pthread_mutex_unlock(&f->mtx);
+	return value;
+}
+
 void stfl_set(struct stfl_form *f, const wchar_t *name, const wchar_t *value)
 {
+	struct stfl_kv *kv;
 	pthread_mutex_lock(&f->mtx);
-	stfl_setkv_by_name_str(f->root, name ? name : L"", value ? value : L"");
+	kv = stfl_form_kv_by_name(f, name ? name : L"");
+	if (kv)
+		stfl_kv_setvalue(kv, value ? value : L"");
+	pthread_mutex_unlock(&f->mtx);
+}
+
+void stfl_set_int(struct stfl_form *f, const wchar_t *name, int value)
+{
+	wchar_t buf[16], *p = buf + 16;
+	unsigned int v = value < 0 ? -(unsigned int)value : value;
+	struct stfl_kv *kv;
+
+	*--p = 0;
+	do {
+		*--p = L'0' + v % 10;
+		v /= 10;
+	} while (v);
+	if (value < 0)
+		*--p = L'-';
+
+	pthread_mutex_lock(&f->mtx);
+	kv = stfl_form_kv_by_name(f, name ? name : L"");
+	if (kv)
+		stfl_kv_setvalue(kv, p);
 	pthread_mutex_unlock(&f->mtx);
 }
 
@@ -144,7 +256,7 @@ void stfl_set_focus(struct stfl_form *f, const wchar_t *name)
 {
 	struct stfl_widget *fw;
 	pthread_mutex_lock(&f->mtx);
-	fw = stfl_widget_by_name(f->root, name ? name : L"");
+	fw = stfl_form_widget_by_name(f, name ? name : L"");
 	stfl_switch_focus(0, fw, f);
 	pthread_mutex_unlock(&f->mtx);
 }
@@ -197,7 +309,7 @@ const wchar_t *stfl_dump(struct stfl_form *f, const wchar_t *name, const wchar_t
 	if (retbuffer)
 		free(retbuffer);
 
-	w = name && *name ? stfl_widget_by_name(f->root, name) : f->root;
+	w = name && *name ? stfl_form_widget_by_name(f, name) : f->root;
 	retbuffer = stfl_widget_dump(w, prefix ? prefix : L"", focus ? f->current_focus_id : 0);
 
 	pthread_setspecific(retbuffer_key, retbuffer);
@@ -229,7 +341,7 @@ const wchar_t *stfl_text(struct stfl_form *f, const wchar_t *name)
 	if (retbuffer)
 		free(retbuffer);
 
-	w = name && *name ? stfl_widget_by_name(f->root, name) : f->root;
+	w = name && *name ? stfl_form_widget_by_name(f, name) : f->root;
 	retbuffer = stfl_widget_text(w);
 
 	pthread_setspecific(retbuffer_key, retbuffer);
@@ -240,47 +352,80 @@ const wchar_t *stfl_text(struct stfl_form *f, const wchar_t *name)
 	return checkret(retbuffer);
 }
 
-static void stfl_modify_before(struct stfl_widget *w, struct stfl_widget *n)
+int stfl_render(struct stfl_form *f, int width, int height, struct stfl_cell *cells)
 {
-	if (!n || !w || !w->parent)
-		return;
+	return stfl_form_render(f, width, height, cells) ? 0 : -1;
+}
 
-	struct stfl_widget **prev_p = &w->parent->first_child;
-	struct stfl_widget *last_n = 0;
+const wchar_t *stfl_render_text(struct stfl_form *f, int width, int height)
+{
+	static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_key_t retbuffer_key;
+	static int firstrun = 1;
+	static wchar_t *retbuffer = 0;
+	int x, y, len;
+
+	if (width <= 0 || height <= 0)
+		return checkret(0);
+
+	struct stfl_cell *cells = malloc(width * height * sizeof(struct stfl_cell));
+
+	if (!stfl_form_render(f, width, height, cells)) {
+		free(cells);
+		return checkret(0);
+	}
+
+	pthread_mutex_lock(&mtx);
+
+	if (firstrun) {
+		pthread_key_create(&retbuffer_key, free);
+		firstrun = 0;
+	}
 
-	while (*prev_p != w)
-		prev_p = &(*prev_p)->next_sibling;
+	retbuffer = pthread_getspecific(retbuffer_key);
 
-	*prev_p = n;
-	while (n) {
-		last_n = n;
-		n->parent = w->parent;
-		n = n->next_sibling;
+	if (retbuffer)
+		free(retbuffer);
+
+	/* one line per row, without trailing blanks */
+	retbuffer = malloc((height * (width + 1) + 1) * sizeof(wchar_t));
+	for (y=len=0; y<height; y++) {
+		int eol = len;
+		for (x=0; x<width; x++) {
+			struct stfl_cell *c = &cells[y*width + x];
+			if (c->ch == 0)
+				continue;
+			retbuffer[len++] = c->ch;
+			if (c->ch != L' ')
+				eol = len;
+		}
+		len = eol;
+		retbuffer[len++] = L'\n';
 	}
+	retbuffer[len] = 0;
 
-	last_n->next_sibling = w;
+	pthread_setspecific(retbuffer_key, retbuffer);
+
+	pthread_mutex_unlock(&mtx);
+	free(cells);
+
+	return checkret(retbuffer);
 }
 
-static void stfl_modify_after(struct stfl_widget *w, struct stfl_widget *n)
+static void stfl_modify_before(struct stfl_widget *w, struct stfl_widget *n)
 {
 	if (!n || !w || !w->parent)
 		return;
 
-	struct stfl_widget *first_n = n;
-	struct stfl_widget *last_n = 0;
-
-	while (n) {
-		last_n = n;
-		n->parent = w->parent;
-		n = n->next_sibling;
-	}
+	stfl_widget_insert(w->parent, w, n);
+}
 
-	if (w->next_sibling)
-		last_n->next_sibling = w->next_sibling;
-	else
-		w->parent->last_child = last_n;
+static void stfl_modify_after(struct stfl_widget *w, struct stfl_widget *n)
+{
+	if (!n || !w || !w->parent)
+		return;
 
-	w->next_sibling = first_n;
+	stfl_widget_insert(w->parent, w->next_sibling, n);
 }
 
 static void stfl_modify_insert(struct stfl_widget *w, struct stfl_widget *n)
@@ -288,21 +433,7 @@ static void stfl_modify_insert(struct stfl_widget *w, struct stfl_widget *n)
 	if (!n || !w)
 		return;
 
-	struct stfl_widget *first_n = n;
-	struct stfl_widget *last_n = 0;
-
-	while (n) {
-		last_n = n;
-		n->parent = w;
-		n = n->next_sibling;
-	}
-
-	if (w->first_child)
-		last_n->next_sibling = w->first_child;
-	else
-		w->last_child = last_n;
-
-	w->first_child = first_n;
+	stfl_widget_insert(w, w->first_child, n);
 }
 
 static void stfl_modify_append(struct stfl_widget *w, struct stfl_widget *n)
@@ -310,46 +441,46 @@ static void stfl_modify_append(struct stfl_widget *w, struct stfl_widget *n)
 	if (!n || !w)
 		return;
 
-	struct stfl_widget *first_n = n;
-	struct stfl_widget *last_n = 0;
-
-	while (n) {
-		last_n = n;
-		n->parent = w;
-		n = n->next_sibling;
-	}
-
-	if (w->last_child)
-		w->last_child->next_sibling = first_n;
-	else
-		w->first_child = first_n;
-
-	w->last_child = last_n;
+	stfl_widget_insert(w, 0, n);
 }
 
-void stfl_modify(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *text)
+/* match "op:pos" or "op:pos:count" */
+static int stfl_modify_range(const wchar_t *mode, const wchar_t *op, int *pos, int *count)
 {
-	struct stfl_widget *w;
-	struct stfl_widget *n;
+	size_t len = wcslen(op);
+	wchar_t *end;
 
-	pthread_mutex_lock(&f->mtx);
-	
-	w = stfl_widget_by_name(f->root, name ? name : L"");
+	if (wcsncmp(mode, op, len) || mode[len] != L':')
+		return 0;
 
-	if (!w)
-		goto unlock;
+	*pos = wcstol(mode + len + 1, &end, 10);
+	*count = *end == L':' ? wcstol(end + 1, 0, 10) : 1;
 
-	mode = mode ? mode : L"";
+	if (*pos < 0)
+		*pos = 0;
+	if (*count < 0)
+		*count = 0;
+	return 1;
+}
 
-	if (!wcscmp(mode, L"delete") && w != f->root) {
-		stfl_widget_free(w);
-		goto unlock;
+/* free count children of w starting at pos, return the child after them */
+static struct stfl_widget *stfl_modify_delete_range(struct stfl_widget *w, int pos, int count)
+{
+	struct stfl_widget *c = stfl_widget_child_at(w, pos);
+
+	while (c && count-- > 0) {
+		struct stfl_widget *next = c->next_sibling;
+		stfl_widget_free(c);
+		c = next;
 	}
 
-	n = stfl_parser(text ? text : L"");
+	return c;
+}
 
-	if (!n)
-		goto unlock;
+/* insert the new tree n at w as specified by mode, the caller holds f->mtx */
+static void stfl_modify_apply(struct stfl_form *f, struct stfl_widget *w, const wchar_t *mode, struct stfl_widget *n)
+{
+	int pos, count;
 
 	if (!wcscmp(mode, L"replace")) {
 		if (w == f->root)
@@ -370,6 +501,22 @@ void stfl_modify(struct stfl_form *f, const wchar_t *name, const wchar_t *mode,
 		goto finish;
 	}
 
+	if (stfl_modify_range(mode, L"replace_at", &pos, &count)) {
+		stfl_widget_insert(w, stfl_modify_delete_range(w, pos, count), n->first_child);
+		n->first_child = n->last_child = 0;
+		stfl_widget_free(n);
+		n = w;
+		goto finish;
+	}
+
+	if (stfl_modify_range(mode, L"insert_at", &pos, &count)) {
+		stfl_widget_insert(w, stfl_widget_child_at(w, pos), n->first_child);
+		n->first_child = n->last_child = 0;
+		stfl_widget_free(n);
+		n = w;
+		goto finish;
+	}
+
 	if (!wcscmp(mode, L"insert")) {
 		stfl_modify_insert(w, n);
 		goto finish;
@@ -422,22 +569,167 @@ void stfl_modify(struct stfl_form *f, const wchar_t *name, const wchar_t *mode,
 		goto finish;
 	}
 
+	stfl_widget_free(n);
+	return;
+
 finish:
 	stfl_check_setfocus(f, n);
+}
+
+/* insert a copy of the widget named source at w, the caller holds f->mtx */
+static void stfl_modify_clone(struct stfl_form *f, struct stfl_widget *w, const wchar_t *mode, const wchar_t *source, const wchar_t *prefix)
+{
+	struct stfl_widget *src = source && *source ? stfl_form_widget_by_name(f, source) : f->root;
+
+	if (src)
+		stfl_modify_apply(f, w, mode, stfl_widget_clone(src, prefix));
+}
+
+void stfl_modify(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *text)
+{
+	struct stfl_widget *w;
+	struct stfl_widget *n;
+	int pos, count;
+
+	stfl_error_clear();
+	pthread_mutex_lock(&f->mtx);
+	
+	w = stfl_form_widget_by_name(f, name ? name : L"");
+
+	if (!w)
+		goto unlock;
+
+	mode = mode ? mode : L"";
+
+	if (!wcsncmp(mode, L"clone:", 6)) {
+		stfl_modify_clone(f, w, mode + 6, text, 0);
+		goto unlock;
+	}
+
+	if (!wcscmp(mode, L"delete") && w != f->root) {
+		stfl_widget_free(w);
+		goto unlock;
+	}
+
+	if (stfl_modify_range(mode, L"delete_at", &pos, &count)) {
+		stfl_modify_delete_range(w, pos, count);
+		goto unlock;
+	}
+
+	n = stfl_parser(text ? text : L"");
+
+	if (n)
+		stfl_modify_apply(f, w, mode, n);
+
 unlock:
 	pthread_mutex_unlock(&f->mtx);
-	return;
+}
+
+void stfl_modify_tree(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, struct stfl_widget *n)
+{
+	struct stfl_widget *w;
+
+	pthread_mutex_lock(&f->mtx);
+
+	w = stfl_form_widget_by_name(f, name ? name : L"");
+
+	if (w)
+		stfl_modify_apply(f, w, mode ? mode : L"", n);
+	else
+		stfl_widget_free(n);
+
+	pthread_mutex_unlock(&f->mtx);
+}
+
+void stfl_modify_lines(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *text)
+{
+	wchar_t *buffer = compat_wcsdup(text ? text : L"");
+	stfl_modify_tree(f, name, mode, stfl_parser_lines(buffer));
+	free(buffer);
+}
+
+void stfl_clone(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *source, const wchar_t *prefix)
+{
+	struct stfl_widget *w;
+
+	pthread_mutex_lock(&f->mtx);
+
+	w = stfl_form_widget_by_name(f, name ? name : L"");
+
+	if (w)
+		stfl_modify_clone(f, w, mode ? mode : L"", source, prefix);
+
+	pthread_mutex_unlock(&f->mtx);
+}
+
+void stfl_begin(struct stfl_form *f)
+{
+	stfl_form_begin(f);
+}
+
+void stfl_commit(struct stfl_form *f)
+{
+	stfl_form_commit(f);
+}
+
+void stfl_error_clear()
+{
+	struct stfl_error_info *e = error_info();
+
+	free(e->message);
+	e->message = 0;
+	e->line = e->column = 0;
+}
+
+/* remember the error for stfl_error() and handle it as set by stfl_error_action() */
+void stfl_error_report(const wchar_t *message, int line, int column)
+{
+	struct stfl_error_info *e = error_info();
+
+	free(e->message);
+	e->message = compat_wcsdup(message);
+	e->line = line;
+	e->column = column;
+
+	if (error_action == ERROR_NONE)
+		return;
+
+	fprintf(stderr, "%ls\r\n", message);
+
+	if (error_action == ERROR_ABORT)
+		abort();
+
+	if (error_action == ERROR_EXIT)
+		exit(1);
 }
 
 const wchar_t *stfl_error()
 {
-	abort();
-	return checkret(0);
+	return checkret(error_info()->message);
+}
+
+int stfl_error_line()
+{
+	return error_info()->line;
+}
+
+int stfl_error_column()
+{
+	return error_info()->column;
 }
 
 void stfl_error_action(const wchar_t *mode)
 {
-	abort();
-	return;
+	if (!mode)
+		return;
+
+	if (!wcscmp(mode, L"abort"))
+		error_action = ERROR_ABORT;
+	else if (!wcscmp(mode, L"exit"))
+		error_action = ERROR_EXIT;
+	else if (!wcscmp(mode, L"print"))
+		error_action = ERROR_PRINT;
+	else if (!wcscmp(mode, L"none"))
+		error_action = ERROR_NONE;
 }
 
@@ -0,0 +1,185 @@
+/*
+ *  STFL - The Structured Terminal Forms Language/Library
+ *  Copyright (C) 2006, 2007  Clifford Wolf <clifford@clifford.at>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *  
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301 USA
+ *
+ *  render.c: Offscreen rendering to a cell buffer
+ */
+
+#include "stfl_internals.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+/*
+ * Forms are rendered offscreen by drawing them to a curses pad on a screen
+ * of its own. That screen writes to /dev/null and is never refreshed, so
+ * no terminal is needed. The pad is read back cell by cell afterwards. The
+ * screen of stfl_run() (if any) stays the current one outside of this.
+ *
+ * set_term() switches the global curses state (stdscr, curscr, ...), so
+ * stfl_run() holds the same lock while it draws. The lock is always taken
+ * after the form lock.
+ */
+
+static pthread_mutex_t render_mtx = PTHREAD_MUTEX_INITIALIZER;
+static SCREEN *render_screen = 0;
+static WINDOW *render_pad = 0;
+static int render_w, render_h;
+
+void stfl_curses_lock()
+{
+	pthread_mutex_lock(&render_mtx);
+}
+
+void stfl_curses_unlock()
+{
+	pthread_mutex_unlock(&render_mtx);
+}
+
+static const char *render_terms[] = { "xterm-256color", "xterm", "ansi", "dumb", 0 };
+
+/* create the offscreen screen and make it the current one, returns the old one */
+static int render_begin(SCREEN **old)
+{
+	FILE *out, *in;
+	int i;
+
+	if (render_screen) {
+		*old = set_term(render_screen);
+		return 1;
+	}
+
+	out = fopen("/dev/null", "w");
+	in = fopen("/dev/null", "r");
+
+	if (!out || !in)
+		goto failed;
+
+	*old = set_term(0);
+
+	for (i=0; render_terms[i] && !render_screen; i++)
+		render_screen = newterm(render_terms[i], out, in);
+
+	if (!render_screen) {
+		set_term(*old);
+		goto failed;
+	}
+
+	start_color();
+	use_default_colors();
+	return 1;
+
+failed:
+	if (out)
+		fclose(out);
+	if (in)
+		fclose(in);
+	return 0;
+}
+
+static unsigned short render_attr(attr_t a)
+{
+	unsigned short attr = 0;
+
+	if (a & A_STANDOUT)
+		attr |= STFL_ATTR_STANDOUT;
+	if (a & A_UNDERLINE)
+		attr |= STFL_ATTR_UNDERLINE;
+	if (a & A_REVERSE)
+		attr |= STFL_ATTR_REVERSE;
+	if (a & A_BLINK)
+		attr |= STFL_ATTR_BLINK;
+	if (a & A_DIM)
+		attr |= STFL_ATTR_DIM;
+	if (a & A_BOLD)
+		attr |= STFL_ATTR_BOLD;
+	if (a & A_PROTECT)
+		attr |= STFL_ATTR_PROTECT;
+	if (a & A_INVIS)
+		attr |= STFL_ATTR_INVIS;
+
+	return attr;
+}
+
+/* prepare and draw the form to cells (h lines of w cells), returns 0 on failure */
+int stfl_form_render(struct stfl_form *f, int w, int h, struct stfl_cell *cells)
+{
+	SCREEN *old;
+	short last_pair = -1, fg = -1, bg = -1;
+	int x, y, wide = 0, ret = 0;
+
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	pthread_mutex_lock(&f->mtx);
+	pthread_mutex_lock(&render_mtx);
+
+	if (!f->root || !render_begin(&old))
+		goto unlock;
+
+	if (!render_pad || render_w != w || render_h != h) {
+		if (render_pad)
+			delwin(render_pad);
+		render_pad = newpad(h, w);
+		render_w = render_pad ? w : 0;
+		render_h = render_pad ? h : 0;
+		if (!render_pad)
+			goto restore;
+	}
+
+	stfl_form_draw(f, render_pad, w, h);
+
+	for (y=0; y<h; y++)
+	{
+		for (x=0; x<w; x++)
+		{
+			struct stfl_cell *c = &cells[y*w + x];
+			wchar_t wch[CCHARW_MAX+1];
+			attr_t attrs;
+			short pair;
+			cchar_t cc;
+
+			mvwin_wch(render_pad, y, x, &cc);
+			getcchar(&cc, wch, &attrs, &pair, 0);
+
+			if (pair != last_pair) {
+				pair_content(pair, &fg, &bg);
+				last_pair = pair;
+			}
+
+			/* the 2nd cell of a double width character repeats it */
+			c->ch = wide ? 0 : wch[0];
+			wide = !wide && x+1 < w && wcwidth(wch[0]) > 1;
+
+			c->attr = render_attr(attrs);
+			c->fg = fg;
+			c->bg = bg;
+		}
+	}
+
+	ret = 1;
+
+restore:
+	set_term(old);
+unlock:
+	pthread_mutex_unlock(&render_mtx);
+	pthread_mutex_unlock(&f->mtx);
+	return ret;
+}
@@ -33,7 +33,7 @@
 #include <stdlib.h>
 #include <locale.h>
 
-static struct stfl_ipool *ipool = 0;
+static int initialized = 0;
 
 extern void SPL_ABI(spl_mod_stfl_init)(struct spl_vm *vm, struct spl_module *mod, int restore);
 extern void SPL_ABI(spl_mod_stfl_done)(struct spl_vm *vm, struct spl_module *mod);
@@ -73,15 +73,22 @@ static struct spl_node *spl_new_nullable_ascii(const char *text)
 // builtin encode_stfl(text)
 
 /**
- * Parse an STFL description text and return the form handler
+ * Parse an STFL description text and return the form handler, or undef
+ * if the text could not be parsed.
  */
 // builtin stfl_create(text)
 static struct spl_node *handler_stfl_create(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
+	struct stfl_form *f = stfl_create(stfl_ipool_towc(ipool, spl_clib_get_string(task)));
+	stfl_ipool_flush(ipool);
+
+	if (!f)
+		return 0;
+
 	struct spl_node *n = SPL_NEW_STRING_DUP("STFL Form");
 	n->hnode_name = strdup("stfl_form");
-	n->hnode_data = stfl_create(stfl_ipool_towc(ipool, spl_clib_get_string(task)));
-	stfl_ipool_flush(ipool);
+	n->hnode_data = f;
 	return n;
 }
 
@@ -91,6 +98,7 @@ static struct spl_node *handler_stfl_create(struct spl_task *task, void *data)
 // builtin stfl_run(form, timeout)
 static struct spl_node *handler_stfl_run(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	struct spl_node *ret = f ? spl_new_nullable_ascii(stfl_ipool_fromwc(ipool, stfl_run(f, spl_clib_get_int(task)))) : 0;
 	stfl_ipool_flush(ipool);
@@ -123,6 +131,7 @@ static struct spl_node *handler_stfl_reset(struct spl_task *task, void *data)
 // builtin stfl_get(form, name)
 static struct spl_node *handler_stfl_get(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	struct spl_node *ret = f ? spl_new_nullable_ascii(stfl_ipool_fromwc(ipool, stfl_get(f, stfl_ipool_towc(ipool, spl_clib_get_string(task))))) : 0;
 	stfl_ipool_flush(ipool);
@@ -135,6 +144,7 @@ static struct spl_node *handler_stfl_get(struct spl_task *task, void *data)
 // builtin stfl_set(form, name, value)
 static struct spl_node *handler_stfl_set(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	char *name = spl_clib_get_string(task);
 	char *value = spl_clib_get_string(task);
@@ -149,6 +159,7 @@ static struct spl_node *handler_stfl_set(struct spl_task *task, void *data)
 // builtin stfl_get_focus(form)
 static struct spl_node *handler_stfl_get_focus(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	struct spl_node *ret = f ? spl_new_nullable_ascii(stfl_ipool_fromwc(ipool, stfl_get_focus(f))) : 0;
 	stfl_ipool_flush(ipool);
@@ -161,6 +172,7 @@ static struct spl_node *handler_stfl_get_focus(struct spl_task *task, void *data
 // builtin stfl_set_focus(form, name)
 static struct spl_node *handler_stfl_set_focus(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	stfl_set_focus(f, stfl_ipool_towc(ipool, spl_clib_get_string(task)));
 	stfl_ipool_flush(ipool);
@@ -173,6 +185,7 @@ static struct spl_node *handler_stfl_set_focus(struct spl_task *task, void *data
 // builtin stfl_quote(text)
 static struct spl_node *handler_stfl_quote(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct spl_node *n = spl_new_nullable_ascii(stfl_ipool_fromwc(ipool, stfl_quote(stfl_ipool_towc(ipool, spl_clib_get_string(task)))));
 	stfl_ipool_flush(ipool);
 	return n;
@@ -184,6 +197,7 @@ static struct spl_node *handler_stfl_quote(struct spl_task *task, void *data)
 // builtin stfl_dump(form, name, prefix, focus)
 static struct spl_node *handler_stfl_dump(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	char *name = spl_clib_get_string(task);
 	char *prefix = spl_clib_get_string(task);
@@ -200,6 +214,7 @@ static struct spl_node *handler_stfl_dump(struct spl_task *task, void *data)
 // builtin stfl_text(form, name)
 static struct spl_node *handler_stfl_text(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	char *name = spl_clib_get_string(task);
 	const char *text = stfl_ipool_fromwc(ipool, stfl_text(f, stfl_ipool_towc(ipool, name)));
@@ -214,6 +229,7 @@ static struct spl_node *handler_stfl_text(struct spl_task *task, void *data)
 // builtin stfl_modify(form, name, mode, text)
 static struct spl_node *handler_stfl_modify(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct stfl_form *f = clib_get_stfl_form(task);
 	char *name = spl_clib_get_string(task);
 	char *mode = spl_clib_get_string(task);
@@ -223,12 +239,69 @@ static struct spl_node *handler_stfl_modify(struct spl_task *task, void *data)
 	return 0;
 }
 
+/**
+ * Insert a copy of an existing widget with prefixed names
+ */
+// builtin stfl_clone(form, name, mode, source, prefix)
+static struct spl_node *handler_stfl_clone(struct spl_task *task, void *data)
+{
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
+	struct stfl_form *f = clib_get_stfl_form(task);
+	char *name = spl_clib_get_string(task);
+	char *mode = spl_clib_get_string(task);
+	char *source = spl_clib_get_string(task);
+	char *prefix = spl_clib_get_string(task);
+	stfl_clone(f, stfl_ipool_towc(ipool, name), stfl_ipool_towc(ipool, mode),
+			stfl_ipool_towc(ipool, source), stfl_ipool_towc(ipool, prefix));
+	stfl_ipool_flush(ipool);
+	return 0;
+}
+
+/**
+ * Render a form to text without a terminal
+ */
+// builtin stfl_render_text(form, width, height)
+static struct spl_node *handler_stfl_render_text(struct spl_task *task, void *data)
+{
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
+	struct stfl_form *f = clib_get_stfl_form(task);
+	int width = spl_clib_get_int(task);
+	int height = spl_clib_get_int(task);
+	const char *text = stfl_ipool_fromwc(ipool, stfl_render_text(f, width, height));
+	struct spl_node *n = spl_new_nullable_ascii(text);
+	stfl_ipool_flush(ipool);
+	return n;
+}
+
+/**
+ * Start a transaction on a form
+ */
+// builtin stfl_begin(form)
+static struct spl_node *handler_stfl_begin(struct spl_task *task, void *data)
+{
+	struct stfl_form *f = clib_get_stfl_form(task);
+	stfl_begin(f);
+	return 0;
+}
+
+/**
+ * Finish a transaction on a form
+ */
+// builtin stfl_commit(form)
+static struct spl_node *handler_stfl_commit(struct spl_task *task, void *data)
+{
+	struct stfl_form *f = clib_get_stfl_form(task);
+	stfl_commit(f);
+	return 0;
+}
+
 /**
  * Return error message of last stfl call or undef.
  */
 // builtin stfl_error()
 static struct spl_node *handler_stfl_error(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	struct spl_node *ret = spl_new_nullable_ascii(stfl_ipool_fromwc(ipool, stfl_error()));
 	stfl_ipool_flush(ipool);
 	return ret;
@@ -240,24 +313,18 @@ static struct spl_node *handler_stfl_error(struct spl_task *task, void *data)
 // builtin stfl_error_action(mode)
 static struct spl_node *handler_stfl_error_action(struct spl_task *task, void *data)
 {
+	struct stfl_ipool *ipool = stfl_ipool_thread("UTF8");
 	char *mode = spl_clib_get_string(task);
 	stfl_error_action(stfl_ipool_towc(ipool, mode));
 	stfl_ipool_flush(ipool);
 	return 0;
 }
 
-static void destroy_ipool_atexit()
-{
-	stfl_ipool_destroy(ipool);
-	ipool = 0;
-}
-
 void SPL_ABI(spl_mod_stfl_init)(struct spl_vm *vm, struct spl_module *mod, int restore)
 {
-	if (!ipool) {
-		ipool = stfl_ipool_create("UTF8");
-		atexit(destroy_ipool_atexit);
+	if (!initialized) {
 		setlocale(LC_ALL,"");
+		initialized = 1;
 	}
 
 	spl_hnode_reg(vm, "stfl_form", handler_stfl_form_node, 0);
@@ -280,6 +347,11 @@ void SPL_ABI(spl_mod_stfl_init)(struct spl_vm *vm, struct spl_module *mod, int r
 	spl_clib_reg(vm, "stfl_dump", handler_stfl_dump, 0);
 	spl_clib_reg(vm, "stfl_text", handler_stfl_text, 0);
 	spl_clib_reg(vm, "stfl_modify", handler_stfl_modify, 0);
+	spl_clib_reg(vm, "stfl_clone", handler_stfl_clone, 0);
+	spl_clib_reg(vm, "stfl_render_text", handler_stfl_render_text, 0);
+
+	spl_clib_reg(vm, "stfl_begin", handler_stfl_begin, 0);
+	spl_clib_reg(vm, "stfl_commit", handler_stfl_commit, 0);
 
 	spl_clib_reg(vm, "stfl_error", handler_stfl_error, 0);
 	spl_clib_reg(vm, "stfl_error_action", handler_stfl_error_action, 0);
@@ -34,6 +34,21 @@ extern int stfl_api_allow_null_pointers;
 struct stfl_form;
 struct stfl_ipool;
 
+#define STFL_ATTR_STANDOUT	0x01
+#define STFL_ATTR_UNDERLINE	0x02
+#define STFL_ATTR_REVERSE	0x04
+#define STFL_ATTR_BLINK		0x08
+#define STFL_ATTR_DIM		0x10
+#define STFL_ATTR_BOLD		0x20
+#define STFL_ATTR_PROTECT	0x40
+#define STFL_ATTR_INVIS		0x80
+
+struct stfl_cell {
+	wchar_t ch;
+	unsigned short attr;
+	short fg, bg;
+};
+
 extern struct stfl_form *stfl_create(const wchar_t *text);
 extern void stfl_free(struct stfl_form *f);
 
@@ -44,6 +59,9 @@ extern void stfl_reset();
 extern const wchar_t * stfl_get(struct stfl_form *f, const wchar_t *name);
 extern void stfl_set(struct stfl_form *f, const wchar_t *name, const wchar_t *value);
 
+extern int stfl_get_int(struct stfl_form *f, const wchar_t *name, int defval);
+extern void stfl_set_int(struct stfl_form *f, const wchar_t *name, int value);
+
 extern const wchar_t *stfl_get_focus(struct stfl_form *f);
 extern void stfl_set_focus(struct stfl_form *f, const wchar_t *name);
 
@@ -51,12 +69,41 @@ extern const wchar_t *stfl_quote(const wchar_t *text);
 extern const wchar_t *stfl_dump(struct stfl_form *f, const wchar_t *name, const wchar_t *prefix, int focus);
 extern const wchar_t *stfl_text(struct stfl_form *f, const wchar_t *name);
 
+extern int stfl_render(struct stfl_form *f, int width, int height, struct stfl_cell *cells);
+extern const wchar_t *stfl_render_text(struct stfl_form *f, int width, int height);
+
 extern void stfl_modify(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *text);
+extern void stfl_modify_lines(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *text);
+extern void stfl_clone(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, const wchar_t *source, const wchar_t *prefix);
+
+extern void stfl_begin(struct stfl_form *f);
+extern void stfl_commit(struct stfl_form *f);
 
 extern const wchar_t *stfl_error();
 extern void stfl_error_action(const wchar_t *mode);
+extern int stfl_error_line();
+extern int stfl_error_column();
+
+extern struct stfl_form *stfl_create_utf8(const char *text);
+extern const char *stfl_run_utf8(struct stfl_form *f, int timeout);
+extern const char *stfl_get_utf8(struct stfl_form *f, const char *name);
+extern void stfl_set_utf8(struct stfl_form *f, const char *name, const char *value);
+extern int stfl_get_int_utf8(struct stfl_form *f, const char *name, int defval);
+extern void stfl_set_int_utf8(struct stfl_form *f, const char *name, int value);
+extern const char *stfl_get_focus_utf8(struct stfl_form *f);
+extern void stfl_set_focus_utf8(struct stfl_form *f, const char *name);
+extern const char *stfl_quote_utf8(const char *text);
+extern const char *stfl_dump_utf8(struct stfl_form *f, const char *name, const char *prefix, int focus);
+extern const char *stfl_text_utf8(struct stfl_form *f, const char *name);
+extern const char *stfl_render_text_utf8(struct stfl_form *f, int width, int height);
+extern void stfl_modify_utf8(struct stfl_form *f, const char *name, const char *mode, const char *text);
+extern void stfl_modify_lines_utf8(struct stfl_form *f, const char *name, const char *mode, const char *text, size_t len);
+extern void stfl_clone_utf8(struct stfl_form *f, const char *name, const char *mode, const char *source, const char *prefix);
+extern const char *stfl_error_utf8();
+extern void stfl_error_action_utf8(const char *mode);
 
 extern struct stfl_ipool *stfl_ipool_create(const char *code);
+extern struct stfl_ipool *stfl_ipool_thread(const char *code);
 extern void *stfl_ipool_add(struct stfl_ipool *pool, void *data);
 extern const wchar_t *stfl_ipool_towc(struct stfl_ipool *pool, const char *buf);
 extern const char *stfl_ipool_fromwc(struct stfl_ipool *pool, const wchar_t *buf);
@@ -47,6 +47,7 @@ struct stfl_widget_type {
 	void (*f_prepare)(struct stfl_widget *w, struct stfl_form *f);
 	void (*f_draw)(struct stfl_widget *w, struct stfl_form *f, WINDOW *win);
 	int (*f_process)(struct stfl_widget *w, struct stfl_widget *fw, struct stfl_form *f, wchar_t ch, int is_function_key);
+	void (*f_sync)(struct stfl_widget *w);
 };
 
 struct stfl_kv {
@@ -54,11 +55,14 @@ struct stfl_kv {
 	struct stfl_widget *widget;
 	wchar_t *key, *value, *name;
 	int id;
+	unsigned int gen;
+	struct stfl_richtext *richtext;
 };
 
 struct stfl_widget {
 	struct stfl_widget *parent;
 	struct stfl_widget *next_sibling;
+	struct stfl_widget *prev_sibling;
 	struct stfl_widget *first_child;
 	struct stfl_widget *last_child;
 	struct stfl_kv *kv_list;
@@ -66,15 +70,64 @@ struct stfl_widget {
 	int id, x, y, w, h, min_w, min_h, cur_x, cur_y;
 	int parser_indent, allow_focus;
 	int setfocus;
+	unsigned int child_gen, layout_gen, inherit_gen;
+	struct stfl_widget *next_by_id;
+	struct stfl_widget *focus_next, *focus_prev;
+	struct stfl_widget *idx_root, *idx_parent, *idx_left, *idx_right;
+	unsigned int idx_prio;
+	int idx_size;
 	void *internal_data;
 	wchar_t *name, *cls;
 };
 
+#define STFL_RICHTEXT_KEEP -1
+#define STFL_RICHTEXT_NORMAL -2
+
+struct stfl_richtext_span {
+	int style, start, pos, len;
+};
+
+struct stfl_richtext {
+	wchar_t *text;
+	struct stfl_richtext_span *spans;
+	int span_count, span_alloc;
+	wchar_t **tags;
+	const wchar_t **styles;
+	int tag_count, tag_alloc;
+	struct stfl_widget *styles_widget;
+	unsigned int styles_gen;
+	int styles_focus;
+};
+
+#define STFL_UNDO_INSERT 1
+#define STFL_UNDO_DELETE 2
+
+struct stfl_undo_rec {
+	int type, backward;
+	int line, col;
+	int len, alloc;
+	wchar_t *text;
+};
+
+struct stfl_undo {
+	struct stfl_undo_rec *recs;
+	int alloc, first, count, current;
+	int can_merge;
+	size_t mem, limit;
+};
+
 struct stfl_event {
 	struct stfl_event *next;
 	wchar_t *event;
 };
 
+struct stfl_name_entry {
+	const wchar_t *name;
+	struct stfl_widget *widget;
+	struct stfl_kv *kv;
+	int next;
+};
+
 struct stfl_form {
 	struct stfl_widget *root;
 	int current_focus_id;
@@ -82,10 +135,17 @@ struct stfl_form {
 	struct stfl_event *event_queue;
 	wchar_t *event;
 	pthread_mutex_t mtx;
+	struct stfl_widget **focus_order;
+	int focus_order_alloc, focus_root_id;
+	unsigned int focus_gen;
+	int batch;
+	struct stfl_name_entry *names;
+	int *name_buckets;
+	int names_count, names_alloc, name_buckets_size;
+	struct stfl_widget *names_root;
+	unsigned int names_gen;
 };
 
-extern int stfl_colorpair_counter;
-
 extern struct stfl_widget_type *stfl_widget_types[];
 
 extern struct stfl_widget_type stfl_widget_type_label;
@@ -102,6 +162,21 @@ extern struct stfl_widget_type stfl_widget_type_checkbox;
 
 extern struct stfl_widget *stfl_widget_new(const wchar_t *type);
 extern void stfl_widget_free(struct stfl_widget *w);
+extern struct stfl_widget *stfl_widget_clone(struct stfl_widget *w, const wchar_t *prefix);
+extern struct stfl_widget *stfl_widget_template(struct stfl_widget *w);
+
+extern void stfl_widget_insert(struct stfl_widget *parent, struct stfl_widget *next, struct stfl_widget *first);
+extern void stfl_widget_unlink(struct stfl_widget *w);
+
+extern void stfl_index_insert(struct stfl_widget *parent, struct stfl_widget *first, struct stfl_widget *next);
+extern void stfl_index_remove(struct stfl_widget *parent, struct stfl_widget *c);
+extern int stfl_widget_child_count(struct stfl_widget *w);
+extern struct stfl_widget *stfl_widget_child_at(struct stfl_widget *w, int pos);
+extern int stfl_widget_child_pos(struct stfl_widget *c);
+
+extern void stfl_widget_sync(struct stfl_widget *w);
+extern void stfl_widget_touch(struct stfl_widget *w);
+extern unsigned int stfl_layout_gen(struct stfl_widget *w);
 
 extern struct stfl_kv *stfl_widget_setkv_int(struct stfl_widget *w, const wchar_t *key, int value);
 extern struct stfl_kv *stfl_widget_setkv_str(struct stfl_widget *w, const wchar_t *key, const wchar_t *value);
@@ -120,6 +195,7 @@ extern struct stfl_widget *stfl_widget_by_name(struct stfl_widget *w, const wcha
 extern struct stfl_widget *stfl_widget_by_id(struct stfl_widget *w, int id);
 
 extern struct stfl_kv *stfl_kv_by_name(struct stfl_widget *w, const wchar_t *name);
+extern void stfl_kv_setvalue(struct stfl_kv *kv, const wchar_t *value);
 extern struct stfl_kv *stfl_kv_by_id(struct stfl_widget *w, int id);
 
 extern struct stfl_widget *stfl_find_child_tree(struct stfl_widget *w, struct stfl_widget *c);
@@ -132,26 +208,58 @@ extern int stfl_focus_next(struct stfl_widget *w, struct stfl_widget *old_fw, st
 extern struct stfl_form *stfl_form_new();
 extern void stfl_form_event(struct stfl_form *f, wchar_t *event);
 extern void stfl_form_run(struct stfl_form *f, int timeout);
+extern void stfl_form_draw(struct stfl_form *f, WINDOW *win, int w, int h);
+extern int stfl_form_render(struct stfl_form *f, int w, int h, struct stfl_cell *cells);
+extern void stfl_curses_lock();
+extern void stfl_curses_unlock();
 extern void stfl_form_reset();
 extern void stfl_form_free(struct stfl_form *f);
+
+extern struct stfl_widget *stfl_form_widget_by_name(struct stfl_form *f, const wchar_t *name);
+extern struct stfl_kv *stfl_form_kv_by_name(struct stfl_form *f, const wchar_t *name);
+extern void stfl_form_begin(struct stfl_form *f);
+extern void stfl_form_commit(struct stfl_form *f);
 extern void stfl_form_redraw();
 
 extern void stfl_check_setfocus(struct stfl_form *f, struct stfl_widget *w);
 
 extern struct stfl_widget *stfl_parser(const wchar_t *text);
 extern struct stfl_widget *stfl_parser_file(const char *filename);
+extern struct stfl_widget *stfl_parser_lines(wchar_t *text);
+
+extern void stfl_modify_tree(struct stfl_form *f, const wchar_t *name, const wchar_t *mode, struct stfl_widget *n);
+
+extern void stfl_error_clear();
+extern void stfl_error_report(const wchar_t *message, int line, int column);
 
 extern wchar_t *stfl_quote_backend(const wchar_t *text);
 extern wchar_t *stfl_widget_dump(struct stfl_widget *w, const wchar_t *prefix, int focus_id);
 extern wchar_t *stfl_widget_text(struct stfl_widget *w);
 
 extern void stfl_style(WINDOW *win, const wchar_t *style);
+extern void stfl_style_frame(WINDOW *screen);
 extern void stfl_widget_style(struct stfl_widget *w, struct stfl_form *f, WINDOW *win);
 
 extern wchar_t *stfl_keyname(wchar_t ch, int isfunckey);
 extern int stfl_matchbind(struct stfl_widget *w, wchar_t ch, int isfunckey, wchar_t *name, wchar_t *auto_desc);
 
+extern void stfl_undo_add(struct stfl_undo *u, int type, int line, int col, const wchar_t *text, int len, int backward);
+extern struct stfl_undo_rec *stfl_undo_undo(struct stfl_undo *u);
+extern struct stfl_undo_rec *stfl_undo_redo(struct stfl_undo *u);
+extern void stfl_undo_break(struct stfl_undo *u);
+extern void stfl_undo_clear(struct stfl_undo *u);
+
+extern size_t stfl_utf8_decode(wchar_t *out, const char *in, size_t len);
+extern size_t stfl_utf8_length(const wchar_t *in, size_t len);
+extern size_t stfl_utf8_encode(char *out, const wchar_t *in, size_t len);
+
+extern struct stfl_richtext *stfl_richtext_parse(const wchar_t *text);
+extern void stfl_richtext_free(struct stfl_richtext *rt);
+extern struct stfl_richtext *stfl_kv_richtext(struct stfl_kv *kv);
+
 extern unsigned int stfl_print_richtext(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, const wchar_t * text, unsigned int width, const wchar_t * style, int has_focus);
+extern unsigned int stfl_print_richtext_kv(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, struct stfl_kv *kv, unsigned int width, const wchar_t * style, int has_focus);
+extern unsigned int stfl_print_richtext_range(struct stfl_widget *w, WINDOW *win, unsigned int y, unsigned int x, struct stfl_kv *kv, int from, int to, unsigned int width, const wchar_t * style, int has_focus);
 
 #ifdef __cplusplus
 }
@@ -21,6 +21,7 @@
  */
 
 #include "stfl_internals.h"
+#include "stfl_compat.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -47,9 +48,9 @@ static wchar_t *wcssep(wchar_t **stringp, const wchar_t *delim) {
 #define STFL_MAX_COLOR_PAIRS 256
 static int stfl_colorpair_bg[STFL_MAX_COLOR_PAIRS];
 static int stfl_colorpair_fg[STFL_MAX_COLOR_PAIRS];
-int stfl_colorpair_counter = 1;
+static int stfl_colorpair_counter = 1;
 
-void stfl_style(WINDOW *win, const wchar_t *style)
+static void style_compile(const wchar_t *style, int *attr_p, int *pair_p)
 {
 	int bg_color = -1, fg_color = -1, attr = A_NORMAL;
 
@@ -185,8 +186,87 @@ void stfl_style(WINDOW *win, const wchar_t *style)
 		stfl_colorpair_counter++;
 	}
 
-	wattrset(win, attr);
-	wcolor_set(win, i, NULL);
+	*attr_p = attr;
+	*pair_p = i;
+}
+
+/*
+ * Compiled styles are cached by their text, so drawing doesn't have to
+ * parse the same style strings again. The cache is simply dropped when it
+ * gets too big (e.g. for styles generated by the application).
+ */
+
+#define STYLE_CACHE_BUCKETS 64
+#define STYLE_CACHE_MAX 1024
+
+struct style_cache_entry {
+	struct style_cache_entry *next;
+	wchar_t *style;
+	int attr, pair;
+};
+
+static struct style_cache_entry *style_cache[STYLE_CACHE_BUCKETS];
+static int style_cache_count;
+
+static void style_cache_flush()
+{
+	int i;
+	for (i = 0; i < STYLE_CACHE_BUCKETS; i++)
+		while (style_cache[i]) {
+			struct style_cache_entry *e = style_cache[i];
+			style_cache[i] = e->next;
+			free(e->style);
+			free(e);
+		}
+	style_cache_count = 0;
+}
+
+/*
+ * Called before a frame is drawn to the curses screen with the given
+ * stdscr. Color pairs and the cached styles using them are kept from frame
+ * to frame, and only started over for a different screen (which has its
+ * own pair table) or when half of the pairs are used up.
+ */
+void stfl_style_frame(WINDOW *screen)
+{
+	static WINDOW *last_screen = 0;
+
+	if (screen == last_screen && stfl_colorpair_counter <= STFL_MAX_COLOR_PAIRS / 2 &&
+	    stfl_colorpair_counter <= COLOR_PAIRS / 2)
+		return;
+
+	style_cache_flush();
+	stfl_colorpair_counter = 1;
+	last_screen = screen;
+}
+
+void stfl_style(WINDOW *win, const wchar_t *style)
+{
+	unsigned int hash = 0;
+	const wchar_t *p;
+
+	for (p = style; *p; p++)
+		hash = hash * 31 + *p;
+	hash %= STYLE_CACHE_BUCKETS;
+
+	struct style_cache_entry *e = style_cache[hash];
+	while (e && wcscmp(e->style, style))
+		e = e->next;
+
+	if (e == NULL) {
+		if (style_cache_count >= STYLE_CACHE_MAX)
+			style_cache_flush();
+
+		e = malloc(sizeof(struct style_cache_entry));
+		style_compile(style, &e->attr, &e->pair);
+		e->style = compat_wcsdup(style);
+		e->next = style_cache[hash];
+		style_cache[hash] = e;
+		style_cache_count++;
+	}
+
+	wattrset(win, e->attr);
+	wcolor_set(win, e->pair, NULL);
 }
 
 void stfl_widget_style(struct stfl_widget *w, struct stfl_form *f, WINDOW *win)
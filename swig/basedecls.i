@@ -30,68 +30,65 @@
 
 typedef struct stfl_form stfl_form;
 
-struct stfl_ipool *ipool = 0;
-
-static void inline ipool_reset() {
-	if (!ipool)
-		ipool = stfl_ipool_create("UTF8");
-	stfl_ipool_flush(ipool);
-}
-
-static void ipool_destroy() {
-	stfl_ipool_destroy(ipool);
-	ipool = 0;
-}
-
-#define TOWC(_t) stfl_ipool_towc(ipool, _t)
-#define FROMWC(_t) stfl_ipool_fromwc(ipool, _t)
-
 %}
 
 typedef struct {
 } stfl_form;
 
+%apply (char *STRING, size_t LENGTH) { (char *lines, size_t len) };
+
 %extend stfl_form
 {
 	stfl_form(char *text) {
-		ipool_reset();
-		return stfl_create(TOWC(text));
+		return stfl_create_utf8(text);
 	}
 	~stfl_form() {
-		ipool_reset();
 		stfl_free(self);
 	}
 	const char *run(int timeout) {
-		ipool_reset();
-		return FROMWC(stfl_run(self, timeout));
+		return stfl_run_utf8(self, timeout);
 	}
 	const char *get(const char *name) {
-		ipool_reset();
-		return FROMWC(stfl_get(self, TOWC(name)));
+		return stfl_get_utf8(self, name);
 	}
 	void set(const char *name, const char *value) {
-		ipool_reset();
-		return stfl_set(self, TOWC(name), TOWC(value));
+		stfl_set_utf8(self, name, value);
+	}
+	int get_int(const char *name, int defval) {
+		return stfl_get_int_utf8(self, name, defval);
+	}
+	void set_int(const char *name, int value) {
+		stfl_set_int_utf8(self, name, value);
 	}
 	const char *get_focus() {
-		ipool_reset();
-		return FROMWC(stfl_get_focus(self));
+		return stfl_get_focus_utf8(self);
 	}
 	void set_focus(const char *name) {
-		ipool_reset();
-		stfl_set_focus(self, TOWC(name));
+		stfl_set_focus_utf8(self, name);
 	}
 	const char *dump(const char *name, const char *prefix, int focus) {
-		ipool_reset();
-		return FROMWC(stfl_dump(self, TOWC(name), TOWC(prefix), focus));
+		return stfl_dump_utf8(self, name, prefix, focus);
 	}
 	const char *text(const char *name) {
-		ipool_reset();
-		return FROMWC(stfl_text(self, TOWC(name)));
+		return stfl_text_utf8(self, name);
 	}
 	void modify(const char *name, const char *mode, const char *text) {
-		ipool_reset();
-		stfl_modify(self, TOWC(name), TOWC(mode), TOWC(text));
+		stfl_modify_utf8(self, name, mode, text);
+	}
+	void modify_lines(const char *name, const char *mode, char *lines, size_t len) {
+		stfl_modify_lines_utf8(self, name, mode, lines, len);
+	}
+	void clone(const char *name, const char *mode, const char *source, const char *prefix) {
+		stfl_clone_utf8(self, name, mode, source, prefix);
+	}
+	const char *render_text(int width, int height) {
+		return stfl_render_text_utf8(self, width, height);
+	}
+	void begin() {
+		stfl_begin(self);
+	}
+	void commit() {
+		stfl_commit(self);
 	}
 }
 
@@ -99,74 +96,87 @@ typedef struct {
 
 static struct stfl_form *stfl_create_wrapper(const char *text)
 {
-	ipool_reset();
-	return stfl_create(TOWC(text));
+	return stfl_create_utf8(text);
 }
 
 static const char *stfl_run_wrapper(struct stfl_form *f, int timeout)
 {
-	ipool_reset();
-	return FROMWC(stfl_run(f, timeout));
+	return stfl_run_utf8(f, timeout);
 }
 
 static const char *stfl_get_wrapper(struct stfl_form *f, const char *name)
 {
-	ipool_reset();
-	return FROMWC(stfl_get(f, TOWC(name)));
+	return stfl_get_utf8(f, name);
 }
 
 static void stfl_set_wrapper(struct stfl_form *f, const char *name, const char *value)
 {
-	ipool_reset();
-	return stfl_set(f, TOWC(name), TOWC(value));
+	stfl_set_utf8(f, name, value);
+}
+
+static int stfl_get_int_wrapper(struct stfl_form *f, const char *name, int defval)
+{
+	return stfl_get_int_utf8(f, name, defval);
+}
+
+static void stfl_set_int_wrapper(struct stfl_form *f, const char *name, int value)
+{
+	stfl_set_int_utf8(f, name, value);
 }
 
 static const char *stfl_get_focus_wrapper(struct stfl_form *f)
 {
-	ipool_reset();
-	return FROMWC(stfl_get_focus(f));
+	return stfl_get_focus_utf8(f);
 }
 
 static void stfl_set_focus_wrapper(struct stfl_form *f, const char *name)
 {
-	ipool_reset();
-	stfl_set_focus(f, TOWC(name));
+	stfl_set_focus_utf8(f, name);
 }
 
 static const char *stfl_quote_wrapper(const char *text)
 {
-	ipool_reset();
-	return FROMWC(stfl_quote(TOWC(text)));
+	return stfl_quote_utf8(text);
 }
 
 static const char *stfl_dump_wrapper(struct stfl_form *f, const char *name, const char *prefix, int focus)
 {
-	ipool_reset();
-	return FROMWC(stfl_dump(f, TOWC(name), TOWC(prefix), focus));
+	return stfl_dump_utf8(f, name, prefix, focus);
 }
 
 static const char *stfl_text_wrapper(struct stfl_form *f, const char *name)
 {
-	ipool_reset();
-	return FROMWC(stfl_text(f, TOWC(name)));
+	return stfl_text_utf8(f, name);
 }
 
 static void stfl_modify_wrapper(struct stfl_form *f, const char *name, const char *mode, const char *text)
 {
-	ipool_reset();
-	stfl_modify(f, TOWC(name), TOWC(mode), TOWC(text));
+	stfl_modify_utf8(f, name, mode, text);
+}
+
+static void stfl_modify_lines_wrapper(struct stfl_form *f, const char *name, const char *mode, char *lines, size_t len)
+{
+	stfl_modify_lines_utf8(f, name, mode, lines, len);
+}
+
+static void stfl_clone_wrapper(struct stfl_form *f, const char *name, const char *mode, const char *source, const char *prefix)
+{
+	stfl_clone_utf8(f, name, mode, source, prefix);
+}
+
+static const char *stfl_render_text_wrapper(struct stfl_form *f, int width, int height)
+{
+	return stfl_render_text_utf8(f, width, height);
 }
 
 static const char *stfl_error_wrapper()
 {
-	ipool_reset();
-	return FROMWC(stfl_error());
+	return stfl_error_utf8();
 }
 
 static void stfl_error_action_wrapper(const char *mode)
 {
-	ipool_reset();
-	stfl_error_action(TOWC(mode));
+	stfl_error_action_utf8(mode);
 }
 
 %}
@@ -175,19 +185,27 @@ static struct stfl_form *stfl_create_wrapper(const char *text);
 static const char *stfl_run_wrapper(struct stfl_form *f, int timeout);
 static const char *stfl_get_wrapper(struct stfl_form *f, const char *name);
 static void stfl_set_wrapper(struct stfl_form *f, const char *name, const char *value);
+static int stfl_get_int_wrapper(struct stfl_form *f, const char *name, int defval);
+static void stfl_set_int_wrapper(struct stfl_form *f, const char *name, int value);
 static const char *stfl_get_focus_wrapper(struct stfl_form *f);
 static void stfl_set_focus_wrapper(struct stfl_form *f, const char *name);
 static const char *stfl_quote_wrapper(const char *text);
 static const char *stfl_dump_wrapper(struct stfl_form *f, const char *name, const char *prefix, int focus);
 static const char *stfl_text_wrapper(struct stfl_form *f, const char *name);
 static void stfl_modify_wrapper(struct stfl_form *f, const char *name, const char *mode, const char *text);
+static void stfl_modify_lines_wrapper(struct stfl_form *f, const char *name, const char *mode, char *lines, size_t len);
+static void stfl_clone_wrapper(struct stfl_form *f, const char *name, const char *mode, const char *source, const char *prefix);
+static const char *stfl_render_text_wrapper(struct stfl_form *f, int width, int height);
 static const char *stfl_error_wrapper();
 static void stfl_error_action_wrapper(const char *mode);
+extern int stfl_error_line();
+extern int stfl_error_column();
+extern void stfl_begin(struct stfl_form *f);
+extern void stfl_commit(struct stfl_form *f);
 extern void stfl_reset();
 extern void stfl_redraw();
 
 %init %{
 	atexit(stfl_reset);
-	atexit(ipool_destroy);
 %}
 
@@ -25,6 +25,8 @@
 
 %rename(stfl_get) stfl_get_wrapper;
 %rename(stfl_set) stfl_set_wrapper;
+%rename(stfl_get_int) stfl_get_int_wrapper;
+%rename(stfl_set_int) stfl_set_int_wrapper;
 
 %rename(stfl_get_focus) stfl_get_focus_wrapper;
 %rename(stfl_set_focus) stfl_set_focus_wrapper;
@@ -33,6 +35,9 @@
 %rename(stfl_dump) stfl_dump_wrapper;
 %rename(stfl_text) stfl_text_wrapper;
 %rename(stfl_modify) stfl_modify_wrapper;
+%rename(stfl_modify_lines) stfl_modify_lines_wrapper;
+%rename(stfl_clone) stfl_clone_wrapper;
+%rename(stfl_render_text) stfl_render_text_wrapper;
 
 %rename(stfl_error) stfl_error_wrapper;
 %rename(stfl_error_action) stfl_error_action_wrapper;
@@ -25,6 +25,8 @@
 
 %rename(get) stfl_get_wrapper;
 %rename(set) stfl_set_wrapper;
+%rename(get_int) stfl_get_int_wrapper;
+%rename(set_int) stfl_set_int_wrapper;
 
 %rename(get_focus) stfl_get_focus_wrapper;
 %rename(set_focus) stfl_set_focus_wrapper;
@@ -33,9 +35,17 @@
 %rename(dump) stfl_dump_wrapper;
 %rename(text) stfl_text_wrapper;
 %rename(modify) stfl_modify_wrapper;
+%rename(modify_lines) stfl_modify_lines_wrapper;
+%rename(clone) stfl_clone_wrapper;
+%rename(render_text) stfl_render_text_wrapper;
+
+%rename(begin) stfl_begin;
+%rename(commit) stfl_commit;
 
 %rename(error) stfl_error_wrapper;
 %rename(error_action) stfl_error_action_wrapper;
+%rename(error_line) stfl_error_line;
+%rename(error_column) stfl_error_column;
 
 %rename(redraw) stfl_redraw;
 %rename(reset) stfl_reset;
@@ -0,0 +1,198 @@
+/*
+ *  STFL - The Structured Terminal Forms Language/Library
+ *  Copyright (C) 2006, 2007  Clifford Wolf <clifford@clifford.at>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *  
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301 USA
+ *
+ *  undo.c: Undo journal for the text editing widgets
+ */
+
+#include "stfl_internals.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <wctype.h>
+
+/*
+ * The journal is an array of insert/delete records. Records between 'first'
+ * and 'first+current' have been applied, the ones up to 'first+count' have
+ * been undone and can be redone. Consecutive single-line edits are merged
+ * into the last record so a run of typing is undone in one step. The oldest
+ * records are dropped when the journal grows beyond 'limit' bytes.
+ */
+
+static size_t rec_size(struct stfl_undo_rec *r)
+{
+	return sizeof(struct stfl_undo_rec) + r->alloc * sizeof(wchar_t);
+}
+
+static void rec_reserve(struct stfl_undo *u, struct stfl_undo_rec *r, int len)
+{
+	if (len <= r->alloc)
+		return;
+
+	u->mem -= rec_size(r);
+	r->alloc = len * 2;
+	r->text = realloc(r->text, r->alloc * sizeof(wchar_t));
+	u->mem += rec_size(r);
+}
+
+static void drop_first(struct stfl_undo *u)
+{
+	struct stfl_undo_rec *r = &u->recs[u->first];
+
+	u->mem -= rec_size(r);
+	free(r->text);
+
+	u->first++;
+	u->count--;
+	u->current--;
+}
+
+static void drop_redo(struct stfl_undo *u)
+{
+	while (u->count > u->current) {
+		struct stfl_undo_rec *r = &u->recs[u->first + --u->count];
+		u->mem -= rec_size(r);
+		free(r->text);
+	}
+}
+
+static int merge(struct stfl_undo *u, int type, int line, int col, const wchar_t *text, int len, int backward)
+{
+	struct stfl_undo_rec *r;
+
+	if (!u->can_merge || u->count == 0 || u->current != u->count)
+		return 0;
+
+	r = &u->recs[u->first + u->count - 1];
+
+	if (r->type != type || r->line != line || r->backward != backward)
+		return 0;
+
+	if (wmemchr(text, L'\n', len) || wmemchr(r->text, L'\n', r->len))
+		return 0;
+
+	if (type == STFL_UNDO_INSERT) {
+		if (r->col + r->len != col)
+			return 0;
+		if (r->len > 0 && iswspace(r->text[r->len-1]) && !iswspace(text[0]))
+			return 0;
+		rec_reserve(u, r, r->len + len);
+		wmemcpy(r->text + r->len, text, len);
+		r->len += len;
+		return 1;
+	}
+
+	if (backward) {
+		if (col + len != r->col)
+			return 0;
+		rec_reserve(u, r, r->len + len);
+		wmemmove(r->text + len, r->text, r->len);
+		wmemcpy(r->text, text, len);
+		r->col = col;
+		r->len += len;
+		return 1;
+	}
+
+	if (col != r->col)
+		return 0;
+	rec_reserve(u, r, r->len + len);
+	wmemcpy(r->text + r->len, text, len);
+	r->len += len;
+	return 1;
+}
+
+void stfl_undo_add(struct stfl_undo *u, int type, int line, int col, const wchar_t *text, int len, int backward)
+{
+	if (u->limit == 0) {
+		stfl_undo_clear(u);
+		return;
+	}
+
+	drop_redo(u);
+
+	if (!merge(u, type, line, col, text, len, backward))
+	{
+		if (u->first + u->count == u->alloc) {
+			if (u->first > 0) {
+				memmove(u->recs, u->recs + u->first, u->count * sizeof(struct stfl_undo_rec));
+				u->first = 0;
+			} else {
+				u->alloc = u->alloc * 2 + 16;
+				u->recs = realloc(u->recs, u->alloc * sizeof(struct stfl_undo_rec));
+			}
+		}
+
+		struct stfl_undo_rec *r = &u->recs[u->first + u->count];
+		memset(r, 0, sizeof(struct stfl_undo_rec));
+		r->type = type;
+		r->backward = backward;
+		r->line = line;
+		r->col = col;
+		u->mem += rec_size(r);
+
+		rec_reserve(u, r, len);
+		wmemcpy(r->text, text, len);
+		r->len = len;
+
+		u->current = ++u->count;
+	}
+
+	while (u->count > 0 && u->mem > u->limit)
+		drop_first(u);
+
+	u->can_merge = 1;
+}
+
+struct stfl_undo_rec *stfl_undo_undo(struct stfl_undo *u)
+{
+	u->can_merge = 0;
+
+	if (u->current == 0)
+		return 0;
+
+	return &u->recs[u->first + --u->current];
+}
+
+struct stfl_undo_rec *stfl_undo_redo(struct stfl_undo *u)
+{
+	u->can_merge = 0;
+
+	if (u->current == u->count)
+		return 0;
+
+	return &u->recs[u->first + u->current++];
+}
+
+void stfl_undo_break(struct stfl_undo *u)
+{
+	u->can_merge = 0;
+}
+
+void stfl_undo_clear(struct stfl_undo *u)
+{
+	u->current = u->count;
+	while (u->count > 0)
+		drop_first(u);
+
+	free(u->recs);
+	u->recs = 0;
+	u->alloc = u->first = u->count = u->current = 0;
+	u->can_merge = 0;
+	u->mem = 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *  STFL - The Structured Terminal Forms Language/Library
+ *  Copyright (C) 2006, 2007  Clifford Wolf <clifford@clifford.at>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 3 of the License, or (at your option) any later version.
+ *  
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301 USA
+ *
+ *  utf8.c: Public STFL API with UTF-8 strings
+ */
+
+#include "stfl_internals.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/*
+ * These functions work like their wchar_t counterparts in public.c but take
+ * and return UTF-8 strings. They use the UTF-8 transcoder from iconv.c and
+ * per-thread buffers that are reused from call to call. A returned string
+ * is valid until the next call of one of these functions in the same thread.
+ * Buffers that grew beyond UTF8_KEEP bytes are freed again when they are no
+ * longer needed, so one huge call doesn't pin that memory to the thread.
+ */
+
+#define UTF8_ARGS 4
+#define UTF8_KEEP (64 * 1024)
+
+struct utf8_buffers {
+	wchar_t *in[UTF8_ARGS];
+	size_t in_alloc[UTF8_ARGS];
+	char *out;
+	size_t out_alloc;
+};
+
+static pthread_key_t utf8_key;
+static pthread_once_t utf8_once = PTHREAD_ONCE_INIT;
+
+static void utf8_buffers_free(void *p)
+{
+	struct utf8_buffers *b = p;
+	int i;
+
+	for (i = 0; i < UTF8_ARGS; i++)
+		free(b->in[i]);
+	free(b->out);
+	free(b);
+}
+
+static void utf8_key_init()
+{
+	pthread_key_create(&utf8_key, utf8_buffers_free);
+}
+
+static struct utf8_buffers *utf8_buffers()
+{
+	struct utf8_buffers *b;
+
+	pthread_once(&utf8_once, utf8_key_init);
+	b = pthread_getspecific(utf8_key);
+
+	if (!b) {
+		b = calloc(1, sizeof(struct utf8_buffers));
+		pthread_setspecific(utf8_key, b);
+	}
+
+	return b;
+}
+
+/* free the big buffers, called when the arguments and the last result are no longer needed */
+static void utf8_trim()
+{
+	struct utf8_buffers *b = utf8_buffers();
+	int i;
+
+	for (i = 0; i < UTF8_ARGS; i++)
+		if (b->in_alloc[i] * sizeof(wchar_t) > UTF8_KEEP) {
+			free(b->in[i]);
+			b->in[i] = 0;
+			b->in_alloc[i] = 0;
+		}
+
+	if (b->out_alloc > UTF8_KEEP) {
+		free(b->out);
+		b->out = 0;
+		b->out_alloc = 0;
+	}
+}
+
+static wchar_t *towc_len(int slot, const char *text, size_t len)
+{
+	struct utf8_buffers *b = utf8_buffers();
+
+	if (b->in_alloc[slot] < len + 1) {
+		b->in_alloc[slot] = len + 64;
+		free(b->in[slot]);
+		b->in[slot] = malloc(b->in_alloc[slot] * sizeof(wchar_t));
+	}
+
+	stfl_utf8_decode(b->in[slot], text, len);
+	return b->in[slot];
+}
+
+static const wchar_t *towc(int slot, const char *text)
+{
+	return text ? towc_len(slot, text, strlen(text)) : 0;
+}
+
+static const char *fromwc(const wchar_t *text)
+{
+	struct utf8_buffers *b = utf8_buffers();
+	size_t len, bytes;
+
+	utf8_trim();
+
+	if (!text)
+		return 0;
+
+	len = wcslen(text);
+	bytes = stfl_utf8_length(text, len) + 1;
+	if (b->out_alloc < bytes) {
+		b->out_alloc = bytes + 256;
+		free(b->out);
+		b->out = malloc(b->out_alloc);
+	}
+
+	stfl_utf8_encode(b->out, text, len);
+	return b->out;
+}
+
+struct stfl_form *stfl_create_utf8(const char *text)
+{
+	struct stfl_form *f = stfl_create(towc(0, text));
+	utf8_trim();
+	return f;
+}
+
+const char *stfl_run_utf8(struct stfl_form *f, int timeout)
+{
+	return fromwc(stfl_run(f, timeout));
+}
+
+const char *stfl_get_utf8(struct stfl_form *f, const char *name)
+{
+	return fromwc(stfl_get(f, towc(0, name)));
+}
+
+void stfl_set_utf8(struct stfl_form *f, const char *name, const char *value)
+{
+	stfl_set(f, towc(0, name), towc(1, value));
+	utf8_trim();
+}
+
+int stfl_get_int_utf8(struct stfl_form *f, const char *name, int defval)
+{
+	return stfl_get_int(f, towc(0, name), defval);
+}
+
+void stfl_set_int_utf8(struct stfl_form *f, const char *name, int value)
+{
+	stfl_set_int(f, towc(0, name), value);
+}
+
+const char *stfl_get_focus_utf8(struct stfl_form *f)
+{
+	return fromwc(stfl_get_focus(f));
+}
+
+void stfl_set_focus_utf8(struct stfl_form *f, const char *name)
+{
+	stfl_set_focus(f, towc(0, name));
+}
+
+const char *stfl_quote_utf8(const char *text)
+{
+	return fromwc(stfl_quote(towc(0, text)));
+}
+
+const char *stfl_dump_utf8(struct stfl_form *f, const char *name, const char *prefix, int focus)
+{
+	return fromwc(stfl_dump(f, towc(0, name), towc(1, prefix), focus));
+}
+
+const char *stfl_text_utf8(struct stfl_form *f, const char *name)
+{
+	return fromwc(stfl_text(f, towc(0, name)));
+}
+
+const char *stfl_render_text_utf8(struct stfl_form *f, int width, int height)
+{
+	return fromwc(stfl_render_text(f, width, height));
+}
+
+void stfl_modify_utf8(struct stfl_form *f, const char *name, const char *mode, const char *text)
+{
+	stfl_modify(f, towc(0, name), towc(1, mode), towc(2, text));
+	utf8_trim();
+}
+
+void stfl_modify_lines_utf8(struct stfl_form *f, const char *name, const char *mode, const char *text, size_t len)
+{
+	wchar_t *lines = towc_len(2, text ? text : "", text ? len : 0);
+	stfl_modify_tree(f, towc(0, name), towc(1, mode), stfl_parser_lines(lines));
+	utf8_trim();
+}
+
+void stfl_clone_utf8(struct stfl_form *f, const char *name, const char *mode, const char *source, const char *prefix)
+{
+	stfl_clone(f, towc(0, name), towc(1, mode), towc(2, source), towc(3, prefix));
+}
+
+const char *stfl_error_utf8()
+{
+	return fromwc(stfl_error());
+}
+
+void stfl_error_action_utf8(const char *mode)
+{
+	stfl_error_action(towc(0, mode));
+}
+
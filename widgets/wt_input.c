@@ -26,22 +26,216 @@
 #include <stdlib.h>
 #include <wctype.h>
 
+/*
+ * The text is kept in a gap buffer so that typing does not copy the whole
+ * string on every keypress. A fenwick tree over the cell widths (the cells
+ * inside the gap count as zero) gives the display width of any prefix in
+ * O(log n). The "text" variable is only written back when it is read from
+ * outside (see wt_input_sync).
+ */
+
+struct input_data {
+	wchar_t *buf;
+	int *widths;
+	int size, gap_start, gap_end;
+	struct stfl_kv *kv;
+	unsigned int gen;
+	int dirty;
+	struct stfl_undo undo;
+};
+
+static int char_width(wchar_t ch)
+{
+	int width = wcwidth(ch);
+	return width > 0 ? width : 0;
+}
+
+static void widths_add(struct input_data *d, int p, int delta)
+{
+	for (p++; p <= d->size; p += p & -p)
+		d->widths[p] += delta;
+}
+
+static int widths_sum(struct input_data *d, int p)
+{
+	int sum = 0;
+	for (; p > 0; p -= p & -p)
+		sum += d->widths[p];
+	return sum;
+}
+
+static void widths_rebuild(struct input_data *d)
+{
+	int i, j;
+
+	for (i=1; i <= d->size; i++)
+		d->widths[i] = i-1 < d->gap_start || i-1 >= d->gap_end ? char_width(d->buf[i-1]) : 0;
+
+	for (i=1; i <= d->size; i++) {
+		j = i + (i & -i);
+		if (j <= d->size)
+			d->widths[j] += d->widths[i];
+	}
+}
+
+static inline int text_len(struct input_data *d)
+{
+	return d->size - (d->gap_end - d->gap_start);
+}
+
+static inline wchar_t char_at(struct input_data *d, int i)
+{
+	return d->buf[i < d->gap_start ? i : i + d->gap_end - d->gap_start];
+}
+
+static int text_width(struct input_data *d, int from, int to)
+{
+	int gap_len = d->gap_end - d->gap_start;
+	return widths_sum(d, to + (to > d->gap_start ? gap_len : 0)) -
+			widths_sum(d, from + (from > d->gap_start ? gap_len : 0));
+}
+
+static void text_load(struct input_data *d, const wchar_t *text)
+{
+	int len = wcslen(text);
+
+	free(d->buf);
+	free(d->widths);
+
+	d->size = len + 64;
+	d->buf = malloc(d->size * sizeof(wchar_t));
+	d->widths = malloc((d->size + 1) * sizeof(int));
+	wmemcpy(d->buf, text, len);
+	d->gap_start = len;
+	d->gap_end = d->size;
+
+	widths_rebuild(d);
+}
+
+static void text_move_gap(struct input_data *d, int pos)
+{
+	while (d->gap_start > pos) {
+		wchar_t ch = d->buf[--d->gap_start];
+		int width = char_width(ch);
+		d->buf[--d->gap_end] = ch;
+		if (width) {
+			widths_add(d, d->gap_start, -width);
+			widths_add(d, d->gap_end, width);
+		}
+	}
+
+	while (d->gap_start < pos) {
+		wchar_t ch = d->buf[d->gap_end++];
+		int width = char_width(ch);
+		d->buf[d->gap_start++] = ch;
+		if (width) {
+			widths_add(d, d->gap_end-1, -width);
+			widths_add(d, d->gap_start-1, width);
+		}
+	}
+}
+
+static void text_insert(struct input_data *d, wchar_t ch)
+{
+	if (d->gap_start == d->gap_end) {
+		int tail_len = d->size - d->gap_end;
+		d->size = d->size * 2 + 64;
+		d->buf = realloc(d->buf, d->size * sizeof(wchar_t));
+		d->widths = realloc(d->widths, (d->size + 1) * sizeof(int));
+		wmemmove(d->buf + d->size - tail_len, d->buf + d->gap_end, tail_len);
+		d->gap_end = d->size - tail_len;
+		widths_rebuild(d);
+	}
+
+	d->buf[d->gap_start] = ch;
+	widths_add(d, d->gap_start++, char_width(ch));
+}
+
+static void text_delete_after(struct input_data *d)
+{
+	widths_add(d, d->gap_end, -char_width(d->buf[d->gap_end]));
+	d->gap_end++;
+}
+
+static void text_replace(struct input_data *d, int pos, int del_len, const wchar_t *ins, int ins_len)
+{
+	int i;
+
+	text_move_gap(d, pos);
+
+	for (i=0; i < del_len; i++)
+		text_delete_after(d);
+
+	for (i=0; i < ins_len; i++)
+		text_insert(d, ins[i]);
+
+	d->dirty = 1;
+}
+
+static struct input_data *input_data(struct stfl_widget *w)
+{
+	struct input_data *d = w->internal_data;
+	struct stfl_kv *kv = stfl_widget_getkv(w, L"text");
+
+	if (!d->buf || kv != d->kv || (kv && kv->gen != d->gen)) {
+		text_load(d, kv ? kv->value : L"");
+		stfl_undo_clear(&d->undo);
+		d->kv = kv;
+		d->gen = kv ? kv->gen : 0;
+		d->dirty = 0;
+	}
+
+	return d;
+}
+
 static void wt_input_init(struct stfl_widget *w)
 {
+	w->internal_data = calloc(1, sizeof(struct input_data));
 	w->allow_focus = 1;
 }
 
-static void fix_offset_pos(struct stfl_widget *w)
+static void wt_input_done(struct stfl_widget *w)
+{
+	struct input_data *d = w->internal_data;
+	stfl_undo_clear(&d->undo);
+	free(d->buf);
+	free(d->widths);
+	free(d);
+}
+
+static void wt_input_sync(struct stfl_widget *w)
+{
+	struct input_data *d = w->internal_data;
+
+	if (!d->dirty)
+		return;
+
+	int len = text_len(d);
+	wchar_t *text = malloc((len + 1) * sizeof(wchar_t));
+	wmemcpy(text, d->buf, d->gap_start);
+	wmemcpy(text + d->gap_start, d->buf + d->gap_end, d->size - d->gap_end);
+	text[len] = 0;
+
+	d->kv = stfl_widget_setkv_str(w, L"text", text);
+	d->gen = d->kv->gen;
+	d->dirty = 0;
+	free(text);
+}
+
+static void fix_offset_pos(struct stfl_widget *w, struct input_data *d)
 {
 	int pos = stfl_widget_getkv_int(w, L"pos", 0);
 	int offset = stfl_widget_getkv_int(w, L"offset", 0);
-	const wchar_t* text = stfl_widget_getkv_str(w, L"text", L"");
-	int text_len = wcslen(text);
+	int len = text_len(d);
 	int changed = 0;
-	int width;
 
-	if (pos > text_len) {
-		pos = text_len;
+	if (pos > len) {
+		pos = len;
+		changed = 1;
+	}
+
+	if (pos < 0) {
+		pos = 0;
 		changed = 1;
 	}
 
@@ -50,9 +244,21 @@ static void fix_offset_pos(struct stfl_widget *w)
 		changed = 1;
 	}
 
-	width = wcswidth(text + offset, pos - offset);
-	while (width >= w->w && pos > offset) {
-		width -= wcwidth(text[offset++]);
+	if (offset < 0) {
+		offset = 0;
+		changed = 1;
+	}
+
+	if (pos > offset && text_width(d, offset, pos) >= w->w) {
+		int lo = offset + 1, hi = pos;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (text_width(d, mid, pos) >= w->w)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		offset = lo;
 		changed = 1;
 	}
 
@@ -69,15 +275,15 @@ static void wt_input_prepare(struct stfl_widget *w, struct stfl_form *f)
 	w->min_w = size;
 	w->min_h = 1;
 
-	fix_offset_pos(w);
+	fix_offset_pos(w, input_data(w));
 }
 
 static void wt_input_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *win)
 {
+	struct input_data *d = input_data(w);
 	int pos = stfl_widget_getkv_int(w, L"pos", 0);
 	int blind = stfl_widget_getkv_int(w, L"blind", 0);
 	int offset = stfl_widget_getkv_int(w, L"offset", 0);
-	const wchar_t * const text_off = stfl_widget_getkv_str(w, L"text", L"") + offset;
 	int i;
 
 	stfl_widget_style(w, f, win);
@@ -86,66 +292,109 @@ static void wt_input_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 		mvwaddwstr(win, w->y, w->x+i, L" ");
 
 	if (!blind) {
-		const int off_len = wcslen(text_off);
-		int width, len;
+		int len = 0, width = 0;
+		int end = text_len(d);
+		wchar_t visible[w->w > 0 ? w->w : 1];
 
-		width = wcswidth(text_off, w->w);
-		if (w->w > off_len)
-			len = off_len;
-		else
-			len = w->w;
-		while (width > w->w)
-			width -= wcwidth(text_off[--len]);
-		mvwaddnwstr(win, w->y, w->x, text_off, len);
+		for (i=offset; i < end && len < w->w; i++) {
+			wchar_t ch = char_at(d, i);
+			if (width + char_width(ch) > w->w)
+				break;
+			width += char_width(ch);
+			visible[len++] = ch;
+		}
+		mvwaddnwstr(win, w->y, w->x, visible, len);
 	}
 
 	if (f->current_focus_id == w->id) {
-		f->root->cur_x = f->cursor_x = w->x + wcswidth(text_off, pos - offset);
+		f->root->cur_x = f->cursor_x = w->x + text_width(d, offset, pos);
 		f->root->cur_y = f->cursor_y = w->y;
 	}
 }
 
 static int wt_input_process(struct stfl_widget *w, struct stfl_widget *fw, struct stfl_form *f, wchar_t ch, int isfunckey)
 {
+	struct input_data *d = input_data(w);
 	int pos = stfl_widget_getkv_int(w, L"pos", 0);
-	const wchar_t *text = stfl_widget_getkv_str(w, L"text", L"");
-	int text_len = wcslen(text);
+	int len = text_len(d);
+
+	if (pos > len)
+		pos = len;
+	if (pos < 0)
+		pos = 0;
+
+	d->undo.limit = stfl_widget_getkv_int(w, L"undo_limit", 65536);
+
+	if (stfl_matchbind(w, ch, isfunckey, L"undo", L"")) {
+		struct stfl_undo_rec *r = stfl_undo_undo(&d->undo);
+		if (!r)
+			return 0;
+		if (r->type == STFL_UNDO_INSERT) {
+			text_replace(d, r->col, r->len, 0, 0);
+			pos = r->col;
+		} else {
+			text_replace(d, r->col, 0, r->text, r->len);
+			pos = r->backward ? r->col + r->len : r->col;
+		}
+		stfl_widget_setkv_int(w, L"pos", pos);
+		fix_offset_pos(w, d);
+		return 1;
+	}
+
+	if (stfl_matchbind(w, ch, isfunckey, L"redo", L"")) {
+		struct stfl_undo_rec *r = stfl_undo_redo(&d->undo);
+		if (!r)
+			return 0;
+		if (r->type == STFL_UNDO_INSERT) {
+			text_replace(d, r->col, 0, r->text, r->len);
+			pos = r->col + r->len;
+		} else {
+			text_replace(d, r->col, r->len, 0, 0);
+			pos = r->col;
+		}
+		stfl_widget_setkv_int(w, L"pos", pos);
+		fix_offset_pos(w, d);
+		return 1;
+	}
 
 	if (pos > 0 && stfl_matchbind(w, ch, isfunckey, L"left", L"LEFT")) {
+		stfl_undo_break(&d->undo);
 		stfl_widget_setkv_int(w, L"pos", pos-1);
-		fix_offset_pos(w);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
-	if (pos < text_len && stfl_matchbind(w, ch, isfunckey, L"right", L"RIGHT")) {
+	if (pos < len && stfl_matchbind(w, ch, isfunckey, L"right", L"RIGHT")) {
+		stfl_undo_break(&d->undo);
 		stfl_widget_setkv_int(w, L"pos", pos+1);
-		fix_offset_pos(w);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
 	// pos1 / home / Ctrl-A
 	if (stfl_matchbind(w, ch, isfunckey, L"home", L"HOME ^A")) {
+		stfl_undo_break(&d->undo);
 		stfl_widget_setkv_int(w, L"pos", 0);
-		fix_offset_pos(w);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
 	// end / Ctrl-E
 	if (stfl_matchbind(w, ch, isfunckey, L"end", L"END ^E")) {
-		stfl_widget_setkv_int(w, L"pos", text_len);
-		fix_offset_pos(w);
+		stfl_undo_break(&d->undo);
+		stfl_widget_setkv_int(w, L"pos", len);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
 	// delete
 	if (stfl_matchbind(w, ch, isfunckey, L"delete", L"DC")) {
-		if (pos == text_len)
+		if (pos == len)
 			return 0;
-		wchar_t newtext[text_len];
-		wmemcpy(newtext, text, pos);
-		wcscpy(newtext + pos, text + pos + 1);
-		stfl_widget_setkv_str(w, L"text", newtext);
-		fix_offset_pos(w);
+		wchar_t old_ch = char_at(d, pos);
+		stfl_undo_add(&d->undo, STFL_UNDO_DELETE, 0, pos, &old_ch, 1, 0);
+		text_replace(d, pos, 1, 0, 0);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
@@ -153,24 +402,20 @@ static int wt_input_process(struct stfl_widget *w, struct stfl_widget *fw, struc
 	if (stfl_matchbind(w, ch, isfunckey, L"backspace", L"BACKSPACE")) {
 		if (pos == 0)
 			return 0;
-		wchar_t newtext[text_len];
-		wmemcpy(newtext, text, pos-1);
-		wcscpy(newtext + pos - 1, text + pos);
-		stfl_widget_setkv_str(w, L"text", newtext);
+		wchar_t old_ch = char_at(d, pos-1);
+		stfl_undo_add(&d->undo, STFL_UNDO_DELETE, 0, pos-1, &old_ch, 1, 1);
+		text_replace(d, pos-1, 1, 0, 0);
 		stfl_widget_setkv_int(w, L"pos", pos-1);
-		fix_offset_pos(w);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
 	// 'normal' characters
 	if (!isfunckey && iswprint(ch)) {
-		wchar_t newtext[text_len + 2];
-		wmemcpy(newtext, text, pos);
-		newtext[pos] = ch;
-		wcscpy(newtext + pos + 1, text + pos);
-		stfl_widget_setkv_str(w, L"text", newtext);
+		stfl_undo_add(&d->undo, STFL_UNDO_INSERT, 0, pos, &ch, 1, 0);
+		text_replace(d, pos, 0, &ch, 1);
 		stfl_widget_setkv_int(w, L"pos", pos+1);
-		fix_offset_pos(w);
+		fix_offset_pos(w, d);
 		return 1;
 	}
 
@@ -180,11 +425,12 @@ static int wt_input_process(struct stfl_widget *w, struct stfl_widget *fw, struc
 struct stfl_widget_type stfl_widget_type_input = {
 	L"input",
 	wt_input_init,
-	0, // f_done
+	wt_input_done,
 	0, // f_enter 
 	0, // f_leave
 	wt_input_prepare,
 	wt_input_draw,
-	wt_input_process
+	wt_input_process,
+	wt_input_sync
 };
 
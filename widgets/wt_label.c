@@ -56,7 +56,7 @@ static void wt_label_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 	}
 
 	if (is_richtext)
-		stfl_print_richtext(w, win, w->y, w->x, text, w->w, style, 0);
+		stfl_print_richtext_kv(w, win, w->y, w->x, stfl_widget_getkv(w, L"text"), w->w, style, 0);
 	else
 		mvwaddnwstr(win, w->y, w->x, text, w->w);
 }
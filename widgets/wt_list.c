@@ -53,6 +53,25 @@ static int first_focusable_pos(struct stfl_widget *w)
 	return 0;
 }
 
+static int is_focusable(struct stfl_widget *c)
+{
+	return stfl_widget_getkv_int(c, L"can_focus", 1) &&
+	       stfl_widget_getkv_int(c, L".display", 1);
+}
+
+static int last_focusable_pos(struct stfl_widget *w)
+{
+	int i;
+	struct stfl_widget *c;
+
+	for (i=stfl_widget_child_count(w)-1, c=w->last_child; c; i--, c=c->prev_sibling)
+	{
+		if (is_focusable(c))
+			return i;
+	}
+	return -1;
+}
+
 static void fix_offset_pos(struct stfl_widget *w)
 {
 	int offset = stfl_widget_getkv_int(w, L"offset", 0);
@@ -70,15 +89,18 @@ static void fix_offset_pos(struct stfl_widget *w)
 
 	int i;
 	int maxpos = -1;
-	struct stfl_widget *c;
+	struct stfl_widget *c = stfl_widget_child_at(w, pos);
 	struct stfl_widget *latest_widget = NULL;
-	for (i=0, c=w->first_child; c; i++, c=c->next_sibling) {
-		if (stfl_widget_getkv_int(c, L"can_focus", 1) &&
-			stfl_widget_getkv_int(c, L".display", 1)) {
-			maxpos = i;
-			latest_widget = c;
-
-			if (maxpos == pos) break;
+	if (c && is_focusable(c)) {
+		maxpos = pos;
+		latest_widget = c;
+	} else {
+		for (i=stfl_widget_child_count(w)-1, c=w->last_child; c; i--, c=c->prev_sibling) {
+			if (is_focusable(c)) {
+				maxpos = i;
+				latest_widget = c;
+				break;
+			}
 		}
 	}
 
@@ -100,14 +122,15 @@ static void stfl_focus_prev_pos(struct stfl_widget *w)
 	int i;
 	struct stfl_widget *c;
 	int pos = stfl_widget_getkv_int(w, L"pos", first_focusable_pos(w));
+	int count = stfl_widget_child_count(w);
 
-	for (i=0, c=w->first_child; c; i++, c=c->next_sibling)
+	i = (pos < count ? pos : count) - 1;
+	for (c=stfl_widget_child_at(w, i); c; i--, c=c->prev_sibling)
 	{
-		if (i >= pos)
-			break;
-		if (stfl_widget_getkv_int(c, L"can_focus", 1) &&
-		    stfl_widget_getkv_int(c, L".display", 1))
+		if (is_focusable(c)) {
 			stfl_widget_setkv_int(w, L"pos", i);
+			break;
+		}
 	}
 	fix_offset_pos(w);
 }
@@ -118,12 +141,10 @@ static void stfl_focus_next_pos(struct stfl_widget *w)
 	struct stfl_widget *c;
 	int pos = stfl_widget_getkv_int(w, L"pos", first_focusable_pos(w));
 
-	for (i=0, c=w->first_child; c; i++, c=c->next_sibling)
+	i = pos >= 0 ? pos + 1 : 0;
+	for (c=stfl_widget_child_at(w, i); c; i++, c=c->next_sibling)
 	{
-		if (i <= pos)
-			continue;
-		if (stfl_widget_getkv_int(c, L"can_focus", 1) &&
-		    stfl_widget_getkv_int(c, L".display", 1)) {
+		if (is_focusable(c)) {
 			stfl_widget_setkv_int(w, L"pos", i);
 			break;
 		}
@@ -171,11 +192,10 @@ static void wt_list_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *win
 	if (f->current_focus_id == w->id)
 		f->cursor_x = f->cursor_y = -1;
 
-	for (i=0, c=w->first_child; c && i < offset+w->h; i++, c=c->next_sibling)
+	i = offset > 0 ? offset : 0;
+	for (c=stfl_widget_child_at(w, i); c && i < offset+w->h; i++, c=c->next_sibling)
 	{
 		int has_focus = 0;
-		if (i < offset)
-			continue;
 
 		if (i == pos) {
 			if (f->current_focus_id == w->id) {
@@ -206,7 +226,7 @@ static void wt_list_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *win
 		}
 
 		if (is_richtext)
-			stfl_print_richtext(w, win, w->y+i-offset, w->x, text, w->w, cur_style, has_focus);
+			stfl_print_richtext_kv(w, win, w->y+i-offset, w->x, stfl_widget_getkv(c, L"text"), w->w, cur_style, has_focus);
 		else
 			mvwaddnwstr(win, w->y+i-offset, w->x, text, w->w);
 	}
@@ -221,14 +241,7 @@ static int wt_list_process(struct stfl_widget *w, struct stfl_widget *fw, struct
 {
 	int pos = stfl_widget_getkv_int(w, L"pos", first_focusable_pos(w));
 
-	int i;
-	int maxpos = -1;
-	struct stfl_widget *c;
-	for (i=0, c=w->first_child; c; i++, c=c->next_sibling) {
-		if (stfl_widget_getkv_int(c, L"can_focus", 1) &&
-		    stfl_widget_getkv_int(c, L".display", 1))
-			maxpos= i;
-	}
+	int maxpos = last_focusable_pos(w);
 
 	if (pos > 0 && stfl_matchbind(w, ch, isfunckey, L"up", L"UP")) {
 		stfl_focus_prev_pos(w);
@@ -24,74 +24,239 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
-
-#define MAX_ROWS 30
-#define MAX_COLS 30
 
 struct table_cell_data {
 	struct stfl_widget *w;
-	struct table_cell_data *mastercell;
 	unsigned char vexpand, hexpand, spanpadding;
-	unsigned char colspan_nr, rowspan_nr;
-	unsigned char colspan, rowspan;
 	unsigned char mc_border_l, mc_border_r;
 	unsigned char mc_border_t, mc_border_b;
 	unsigned char border_l, border_r;
 	unsigned char border_t, border_b;
+	unsigned char tie_l, tie_r, tie_t, tie_b;
+	int colspan_nr, rowspan_nr;
+	int colspan, rowspan;
+	int width, height;
+	int min_w, min_h;
+	struct stfl_widget *focus;
+	int link_l, link_r, link_u, link_d;
 };
 
 struct table_rowcol_data {
-	unsigned char min, size;
-	unsigned char expand;
+	int *min, *size;
+	unsigned char *expand;
 };
 
+/*
+ * The cells are stored in one row-major array of alloc_cols * alloc_rows
+ * entries, cells without a widget are unused. The grid is only rebuilt
+ * when the layout generation of the table has changed, i.e. when widgets
+ * were added or removed below it or cell variables (or the '@' defaults they
+ * inherit) were set.
+ *
+ * The minimum row and column sizes are only solved again when the grid
+ * was rebuilt or the minimum size of a cell widget changed, and the final
+ * sizes only when the size of the table changed.
+ *
+ * For keyboard navigation every cell links to the nearest cell in each
+ * direction that belongs to another widget and contains a focusable
+ * widget. The links and the child -> cell hash are built with the grid.
+ */
+
 struct table_data {
 	int rows, cols;
-	struct table_cell_data *map[MAX_COLS][MAX_ROWS];
-	struct table_rowcol_data *rowd;
-	struct table_rowcol_data *cold;
+	int alloc_rows, alloc_cols;
+	int max_colspan, max_rowspan;
+	unsigned int gen;
+	struct table_cell_data *cells;
+	struct table_rowcol_data rowd, cold;
+	int *masters;
+	int master_count;
+	struct stfl_widget **hash_keys;
+	int *hash_cells;
+	int hash_size, linked;
+	int solved, min_w, min_h;
+	int sized_w, sized_h;
 };
 
-static void free_table_data(struct table_data *d)
+static inline int max(int a, int b) {
+	return a > b ? a : b;
+}
+
+static inline struct table_cell_data *table_cell(struct table_data *d, int i, int j)
 {
-	int i, j;
+	struct table_cell_data *m;
 
-	for (i=0; i < MAX_COLS; i++)
-	for (j=0; j < MAX_ROWS; j++)
-		if (d->map[i][j])
-			free(d->map[i][j]);
+	if (i < 0 || j < 0 || i >= d->alloc_cols || j >= d->alloc_rows)
+		return 0;
 
-	free(d->rowd);
-	free(d->cold);
-	free(d);
+	m = &d->cells[j*d->alloc_cols + i];
+	return m->w ? m : 0;
 }
 
-static inline int max(int a, int b) {
-	return a > b ? a : b;
+static inline struct table_cell_data *table_mastercell(struct table_data *d, int i, int j)
+{
+	struct table_cell_data *m = table_cell(d, i, j);
+	return table_cell(d, i - m->colspan_nr, j - m->rowspan_nr);
 }
 
-static void wt_table_done(struct stfl_widget *w)
+static void table_reserve(struct table_data *d, int cols, int rows)
 {
-	if (w->internal_data)
-		free_table_data(w->internal_data);
+	int new_cols = d->alloc_cols, new_rows = d->alloc_rows;
+	int j;
+
+	if (cols <= new_cols && rows <= new_rows)
+		return;
+
+	if (cols > new_cols)
+		new_cols = max(cols, new_cols * 2);
+
+	if (rows > new_rows)
+		new_rows = max(rows, new_rows * 2);
+
+	struct table_cell_data *cells = calloc(new_cols * new_rows, sizeof(struct table_cell_data));
+	for (j=0; j < d->alloc_rows; j++)
+		memcpy(cells + j*new_cols, d->cells + j*d->alloc_cols, d->alloc_cols * sizeof(struct table_cell_data));
+
+	free(d->cells);
+	d->cells = cells;
+	d->alloc_cols = new_cols;
+	d->alloc_rows = new_rows;
 }
 
-static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
+static void rowcol_alloc(struct table_rowcol_data *rc, int count)
 {
-	struct table_data *d = calloc(1, sizeof(struct table_data));
+	free(rc->min);
+	free(rc->size);
+	free(rc->expand);
 
-	if (w->internal_data)
-		free_table_data(w->internal_data);
-	w->internal_data = d;
+	rc->min = calloc(count, sizeof(int));
+	rc->size = calloc(count, sizeof(int));
+	rc->expand = calloc(count, sizeof(unsigned char));
+}
 
-	d->rows = 1;
+static inline unsigned int table_hash(struct table_data *d, struct stfl_widget *c)
+{
+	return ((unsigned long)c / sizeof(struct stfl_widget)) & (d->hash_size - 1);
+}
+
+static void table_hash_build(struct table_data *d)
+{
+	int i;
+
+	d->hash_size = 16;
+	while (d->hash_size < 2 * d->master_count)
+		d->hash_size *= 2;
+
+	free(d->hash_keys);
+	free(d->hash_cells);
+	d->hash_keys = calloc(d->hash_size, sizeof(struct stfl_widget *));
+	d->hash_cells = calloc(d->hash_size, sizeof(int));
+
+	for (i=0; i < d->master_count; i++) {
+		struct stfl_widget *c = d->cells[d->masters[i]].w;
+		unsigned int h = table_hash(d, c);
+		while (d->hash_keys[h])
+			h = (h + 1) & (d->hash_size - 1);
+		d->hash_keys[h] = c;
+		d->hash_cells[h] = d->masters[i];
+	}
+}
+
+static int table_hash_lookup(struct table_data *d, struct stfl_widget *c)
+{
+	unsigned int h = table_hash(d, c);
+
+	while (d->hash_keys[h]) {
+		if (d->hash_keys[h] == c)
+			return d->hash_cells[h];
+		h = (h + 1) & (d->hash_size - 1);
+	}
+
+	return -1;
+}
+
+static void table_link(struct table_data *d)
+{
+	int i, j, k, last;
+
+	for (k=0; k < d->master_count; k++) {
+		struct table_cell_data *m = &d->cells[d->masters[k]];
+		struct stfl_widget *focus = stfl_find_first_focusable(m->w);
+		int mi = d->masters[k] % d->alloc_cols;
+		int mj = d->masters[k] / d->alloc_cols;
+		for (j=mj; j < mj + m->rowspan; j++)
+		for (i=mi; i < mi + m->colspan; i++)
+			table_cell(d, i, j)->focus = focus;
+	}
+
+	// cells of the same widget are next to each other, so if the last
+	// focusable cell is part of the current widget, take the link of
+	// the previous cell
+#define LINK(_i, _j, _prev_i, _prev_j, _link) do { \
+		struct table_cell_data *m = table_cell(d, _i, _j); \
+		if (!m) break; \
+		m->_link = last >= 0 && d->cells[last].w == m->w ? \
+				table_cell(d, _prev_i, _prev_j)->_link : last; \
+		if (m->focus) \
+			last = (_j)*d->alloc_cols + (_i); \
+	} while (0)
+
+	for (j=0; j < d->rows; j++) {
+		for (i=0, last=-1; i < d->cols; i++)
+			LINK(i, j, i-1, j, link_l);
+		for (i=d->cols-1, last=-1; i >= 0; i--)
+			LINK(i, j, i+1, j, link_r);
+	}
+
+	for (i=0; i < d->cols; i++) {
+		for (j=0, last=-1; j < d->rows; j++)
+			LINK(i, j, i, j-1, link_u);
+		for (j=d->rows-1, last=-1; j >= 0; j--)
+			LINK(i, j, i, j+1, link_d);
+	}
+
+#undef LINK
+
+	d->linked = 1;
+}
+
+static void wt_table_init(struct stfl_widget *w)
+{
+	w->internal_data = calloc(1, sizeof(struct table_data));
+}
+
+static void wt_table_done(struct stfl_widget *w)
+{
+	struct table_data *d = w->internal_data;
+
+	free(d->rowd.min);
+	free(d->rowd.size);
+	free(d->rowd.expand);
+	free(d->cold.min);
+	free(d->cold.size);
+	free(d->cold.expand);
+
+	free(d->masters);
+	free(d->hash_keys);
+	free(d->hash_cells);
+	free(d->cells);
+	free(d);
+}
+
+static void table_build(struct stfl_widget *w, struct table_data *d)
+{
 	int col_counter = 0;
 	int row_counter = 0;
-	int max_colspan = 0;
-	int max_rowspan = 0;
 	int i, j;
 
+	if (d->cells)
+		memset(d->cells, 0, d->alloc_cols * d->alloc_rows * sizeof(struct table_cell_data));
+
+	d->rows = 1;
+	d->cols = 0;
+	d->max_colspan = 0;
+	d->max_rowspan = 0;
+
 	struct stfl_widget *c = w->first_child;
 	while (c) {
 		if (!wcscmp(c->type->name, L"tablebr")) {
@@ -99,146 +264,207 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 				row_counter++;
 			col_counter = 0;
 		} else {
-			while (d->map[col_counter][row_counter])
+			while (table_cell(d, col_counter, row_counter))
 				col_counter++;
 
-			assert(col_counter < MAX_COLS && row_counter < MAX_ROWS);
-
-			int colspan = stfl_widget_getkv_int(c, L".colspan", 1);
-			int rowspan = stfl_widget_getkv_int(c, L".rowspan", 1);
+			int colspan = max(stfl_widget_getkv_int(c, L".colspan", 1), 1);
+			int rowspan = max(stfl_widget_getkv_int(c, L".rowspan", 1), 1);
 
-			max_colspan = max(max_colspan, colspan);
-			max_rowspan = max(max_rowspan, rowspan);
+			d->max_colspan = max(d->max_colspan, colspan);
+			d->max_rowspan = max(d->max_rowspan, rowspan);
 
 			d->cols = max(d->cols, col_counter+colspan);
 			d->rows = max(d->rows, row_counter+rowspan);
 
+			table_reserve(d, d->cols, d->rows);
+
 			const wchar_t *expand = stfl_widget_getkv_str(c, L".expand", L"vh");
 			const wchar_t *spacer = stfl_widget_getkv_str(c, L".spacer", L"");
 			const wchar_t *border = stfl_widget_getkv_str(c, L".border", L"");
+			const wchar_t *tie = stfl_widget_getkv_str(c, L".tie", L"lrtb");
 
 			for (i=col_counter; i<col_counter+colspan; i++)
 			for (j=row_counter; j<row_counter+rowspan; j++)
 			{
-				d->map[i][j] = calloc(1, sizeof(struct table_cell_data));
-				d->map[i][j]->mastercell = d->map[col_counter][row_counter];
+				struct table_cell_data *m = &d->cells[j*d->alloc_cols + i];
+				struct table_cell_data *n;
 
 				if (i != col_counter || j != row_counter)
-					d->map[i][j]->spanpadding = 1;
+					m->spanpadding = 1;
 
-				d->map[i][j]->colspan_nr = i-col_counter;
-				d->map[i][j]->rowspan_nr = j-row_counter;
+				m->colspan_nr = i-col_counter;
+				m->rowspan_nr = j-row_counter;
 
-				d->map[i][j]->vexpand = wcschr(expand, L'v') != 0;
-				d->map[i][j]->hexpand = wcschr(expand, L'h') != 0;
+				m->vexpand = wcschr(expand, L'v') != 0;
+				m->hexpand = wcschr(expand, L'h') != 0;
 
 				if (i == col_counter) {
-					if (wcschr(spacer, L'l') != 0) d->map[i][j]->border_l = 1;
-					if (wcschr(border, L'l') != 0) d->map[i][j]->border_l = 2;
+					if (wcschr(spacer, L'l') != 0) m->border_l = 1;
+					if (wcschr(border, L'l') != 0) m->border_l = 2;
 				}
 
 				if (i == col_counter+colspan-1) {
-					if (wcschr(spacer, L'r') != 0) d->map[i][j]->border_r = 1;
-					if (wcschr(border, L'r') != 0) d->map[i][j]->border_r = 2;
+					if (wcschr(spacer, L'r') != 0) m->border_r = 1;
+					if (wcschr(border, L'r') != 0) m->border_r = 2;
 				}
 
 				if (j == row_counter) {
-					if (wcschr(spacer, L't') != 0) d->map[i][j]->border_t = 1;
-					if (wcschr(border, L't') != 0) d->map[i][j]->border_t = 2;
+					if (wcschr(spacer, L't') != 0) m->border_t = 1;
+					if (wcschr(border, L't') != 0) m->border_t = 2;
 				}
 
 				if (j == row_counter+rowspan-1) {
-					if (wcschr(spacer, L'b') != 0) d->map[i][j]->border_b = 1;
-					if (wcschr(border, L'b') != 0) d->map[i][j]->border_b = 2;
+					if (wcschr(spacer, L'b') != 0) m->border_b = 1;
+					if (wcschr(border, L'b') != 0) m->border_b = 2;
 				}
 
-				if (i > 0 && d->map[i-1][j])
-					d->map[i-1][j]->border_r = d->map[i][j]->border_l = max(d->map[i-1][j]->border_r, d->map[i][j]->border_l);
+				if ((n = table_cell(d, i-1, j)) != 0)
+					n->border_r = m->border_l = max(n->border_r, m->border_l);
 
-				if (j > 0 && d->map[i][j-1])
-					d->map[i][j-1]->border_b = d->map[i][j]->border_t = max(d->map[i][j-1]->border_b, d->map[i][j]->border_t);
+				if ((n = table_cell(d, i, j-1)) != 0)
+					n->border_b = m->border_t = max(n->border_b, m->border_t);
 
-				d->map[i][j]->colspan = colspan;
-				d->map[i][j]->rowspan = rowspan;
-				d->map[i][j]->w = c;
+				m->colspan = colspan;
+				m->rowspan = rowspan;
+				m->w = c;
 			}
 
+			struct table_cell_data *m = table_cell(d, col_counter, row_counter);
+			m->tie_l = wcschr(tie, L'l') != 0;
+			m->tie_r = wcschr(tie, L'r') != 0;
+			m->tie_t = wcschr(tie, L't') != 0;
+			m->tie_b = wcschr(tie, L'b') != 0;
+			m->width = stfl_widget_getkv_int(c, L".width", 1);
+			m->height = stfl_widget_getkv_int(c, L".height", 1);
+			m->min_w = m->min_h = -1;
+
 			col_counter += colspan;
 		}
-		c->type->f_prepare(c, f);
 		c = c->next_sibling;
 	}
 
-	d->rowd = calloc(d->rows, sizeof(struct table_rowcol_data));
-	d->cold = calloc(d->cols, sizeof(struct table_rowcol_data));
+	table_reserve(d, d->cols, d->rows);
+	rowcol_alloc(&d->rowd, d->rows);
+	rowcol_alloc(&d->cold, d->cols);
+
+	free(d->masters);
+	d->masters = malloc(d->rows * d->cols * sizeof(int));
+	d->master_count = 0;
+
+	for (row_counter=0; row_counter < d->rows; row_counter++)
+	for (col_counter=0; col_counter < d->cols; col_counter++)
+	{
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
+		if (m && !m->spanpadding)
+			d->masters[d->master_count++] = row_counter*d->alloc_cols + col_counter;
+	}
 
-	for (i=1; i<=max_colspan; i++)
+	for (i=1; i<=d->max_colspan; i++)
 	for (row_counter=0; row_counter < d->rows; row_counter++)
 	for (col_counter=0; col_counter < d->cols; col_counter++)
 	{
-		if (d->map[col_counter][row_counter] == 0 ||
-		    d->map[col_counter][row_counter]->hexpand == 0 ||
-		    d->map[col_counter][row_counter]->spanpadding ||
-		    d->map[col_counter][row_counter]->colspan > i)
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
+
+		if (m == 0 || m->hexpand == 0 || m->spanpadding || m->colspan > i)
 			continue;
 
 		int expand_ok = 0;
-		for (j=0; j < d->map[col_counter][row_counter]->colspan; j++)
-			if (d->cold[col_counter+j].expand) {
+		for (j=0; j < m->colspan; j++)
+			if (d->cold.expand[col_counter+j]) {
 				expand_ok = 1;
 				break;
 			}
 		if (expand_ok)
 			continue;
 
-		for (j=0; j < d->map[col_counter][row_counter]->colspan; j++)
-			d->cold[col_counter+j].expand = 1;
+		for (j=0; j < m->colspan; j++)
+			d->cold.expand[col_counter+j] = 1;
 	}
 
-	for (i=1; i<=max_rowspan; i++)
+	for (i=1; i<=d->max_rowspan; i++)
 	for (row_counter=0; row_counter < d->rows; row_counter++)
 	for (col_counter=0; col_counter < d->cols; col_counter++)
 	{
-		if (d->map[col_counter][row_counter] == 0 ||
-		    d->map[col_counter][row_counter]->vexpand == 0 ||
-		    d->map[col_counter][row_counter]->spanpadding ||
-		    d->map[col_counter][row_counter]->rowspan > i)
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
+
+		if (m == 0 || m->vexpand == 0 || m->spanpadding || m->rowspan > i)
 			continue;
 
 		int expand_ok = 0;
-		for (j=0; j < d->map[col_counter][row_counter]->rowspan; j++)
-			if (d->rowd[row_counter+j].expand) {
+		for (j=0; j < m->rowspan; j++)
+			if (d->rowd.expand[row_counter+j]) {
 				expand_ok = 1;
 				break;
 			}
 		if (expand_ok)
 			continue;
 
-		for (j=0; j < d->map[col_counter][row_counter]->rowspan; j++)
-			d->rowd[row_counter+j].expand = 1;
+		for (j=0; j < m->rowspan; j++)
+			d->rowd.expand[row_counter+j] = 1;
 	}
 
 	for (row_counter=0; row_counter < d->rows; row_counter++)
 	for (col_counter=0; col_counter < d->cols; col_counter++)
 	{
-		struct table_cell_data *m = d->map[col_counter][row_counter];
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
 		if(m==NULL) continue;
-		m->mastercell->mc_border_l = max(m->mastercell->mc_border_l, m->border_l);
-		m->mastercell->mc_border_r = max(m->mastercell->mc_border_r, m->border_r);
-		m->mastercell->mc_border_t = max(m->mastercell->mc_border_t, m->border_t);
-		m->mastercell->mc_border_b = max(m->mastercell->mc_border_b, m->border_b);
+		struct table_cell_data *mc = table_mastercell(d, col_counter, row_counter);
+		mc->mc_border_l = max(mc->mc_border_l, m->border_l);
+		mc->mc_border_r = max(mc->mc_border_r, m->border_r);
+		mc->mc_border_t = max(mc->mc_border_t, m->border_t);
+		mc->mc_border_b = max(mc->mc_border_b, m->border_b);
+	}
+
+	table_hash_build(d);
+
+	d->gen = stfl_layout_gen(w);
+	d->solved = 0;
+	d->linked = 0;
+}
+
+static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
+{
+	struct table_data *d = w->internal_data;
+	int col_counter, row_counter;
+	int i, j;
+
+	if (d->gen != stfl_layout_gen(w) || !d->cells)
+		table_build(w, d);
+
+	struct stfl_widget *c = w->first_child;
+	while (c) {
+		c->type->f_prepare(c, f);
+		c = c->next_sibling;
+	}
+
+	for (i=0; i < d->master_count; i++) {
+		struct table_cell_data *m = &d->cells[d->masters[i]];
+		if (m->min_w != m->w->min_w || m->min_h != m->w->min_h) {
+			m->min_w = m->w->min_w;
+			m->min_h = m->w->min_h;
+			d->solved = 0;
+		}
 	}
 
-	for (i=1; i<=max_colspan; i++)
+	if (d->solved) {
+		w->min_w = d->min_w;
+		w->min_h = d->min_h;
+		return;
+	}
+
+	memset(d->rowd.min, 0, d->rows * sizeof(int));
+	memset(d->cold.min, 0, d->cols * sizeof(int));
+
+	for (i=1; i<=d->max_colspan; i++)
 	for (row_counter=0; row_counter < d->rows; row_counter++)
 	for (col_counter=0; col_counter < d->cols; col_counter++)
 	{
-		struct table_cell_data *m = d->map[col_counter][row_counter];
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
 
 		if (m == 0 || m->spanpadding || m->colspan > i)
 			continue;
 
-		int min_w = max(m->w->min_w, stfl_widget_getkv_int(m->w, L".width", 1));
+		int min_w = max(m->min_w, m->width);
 
 		if (col_counter == 0 && m->mc_border_l)
 			min_w += 3;
@@ -249,7 +475,7 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 		int total = min_w;
 
 		for (j=0; j<m->colspan; j++)
-			total -= d->cold[col_counter+j].min;
+			total -= d->cold.min[col_counter+j];
 
 		if (total <= 0)
 			continue;
@@ -257,7 +483,7 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 		int expandables = 0;
 
 		for (j=0; j<m->colspan; j++)
-			if (d->cold[col_counter+j].expand)
+			if (d->cold.expand[col_counter+j])
 				expandables++;
 
 		if (expandables > 0)
@@ -265,10 +491,10 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 			int per = total / expandables;
 			int extra_per = total % expandables;
 			for (j=0; j<m->colspan; j++)
-				if (d->cold[col_counter+j].expand) {
-					d->cold[col_counter+j].min += per;
+				if (d->cold.expand[col_counter+j]) {
+					d->cold.min[col_counter+j] += per;
 					if (extra_per) {
-						d->cold[col_counter+j].min++;
+						d->cold.min[col_counter+j]++;
 						extra_per--;
 					}
 				}
@@ -278,25 +504,25 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 			int per = total / m->colspan;
 			int extra_per = total % m->colspan;
 			for (j=0; j<m->colspan; j++) {
-				d->cold[col_counter+j].min += per;
+				d->cold.min[col_counter+j] += per;
 				if (extra_per) {
-					d->cold[col_counter+j].min++;
+					d->cold.min[col_counter+j]++;
 					extra_per--;
 				}
 			}
 		}
 	}
 
-	for (i=1; i<=max_rowspan; i++)
+	for (i=1; i<=d->max_rowspan; i++)
 	for (row_counter=0; row_counter < d->rows; row_counter++)
 	for (col_counter=0; col_counter < d->cols; col_counter++)
 	{
-		struct table_cell_data *m = d->map[col_counter][row_counter];
+		struct table_cell_data *m = table_cell(d, col_counter, row_counter);
 
 		if (m == 0 || m->spanpadding || m->rowspan > i)
 			continue;
 
-		int min_h = max(m->w->min_h, stfl_widget_getkv_int(m->w, L".height", 1));
+		int min_h = max(m->min_h, m->height);
 
 		if (row_counter == 0 && m->mc_border_t)
 			min_h++;
@@ -307,7 +533,7 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 		int total = min_h;
 
 		for (j=0; j<m->rowspan; j++)
-			total -= d->rowd[row_counter+j].min;
+			total -= d->rowd.min[row_counter+j];
 
 		if (total <= 0)
 			continue;
@@ -315,7 +541,7 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 		int expandables = 0;
 
 		for (j=0; j<m->rowspan; j++)
-			if (d->rowd[row_counter+j].expand)
+			if (d->rowd.expand[row_counter+j])
 				expandables++;
 
 		if (expandables > 0)
@@ -323,10 +549,10 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 			int per = total / expandables;
 			int extra_per = total % expandables;
 			for (j=0; j<m->rowspan; j++)
-				if (d->rowd[row_counter+j].expand) {
-					d->rowd[row_counter+j].min += per;
+				if (d->rowd.expand[row_counter+j]) {
+					d->rowd.min[row_counter+j] += per;
 					if (extra_per) {
-						d->rowd[row_counter+j].min++;
+						d->rowd.min[row_counter+j]++;
 						extra_per--;
 					}
 				}
@@ -336,9 +562,9 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 			int per = total / m->rowspan;
 			int extra_per = total % m->rowspan;
 			for (j=0; j<m->rowspan; j++) {
-				d->rowd[row_counter+j].min += per;
+				d->rowd.min[row_counter+j] += per;
 				if (extra_per) {
-					d->rowd[row_counter+j].min++;
+					d->rowd.min[row_counter+j]++;
 					extra_per--;
 				}
 			}
@@ -347,9 +573,14 @@ static void wt_table_prepare(struct stfl_widget *w, struct stfl_form *f)
 
 	w->min_h = w->min_w = 0;
 	for (row_counter=0; row_counter < d->rows; row_counter++)
-		w->min_h += d->rowd[row_counter].min;
+		w->min_h += d->rowd.min[row_counter];
 	for (col_counter=0; col_counter < d->cols; col_counter++)
-		w->min_w += d->cold[col_counter].min;
+		w->min_w += d->cold.min[col_counter];
+
+	d->min_w = w->min_w;
+	d->min_h = w->min_h;
+	d->solved = 1;
+	d->sized_w = d->sized_h = -1;
 }
 
 void make_corner(WINDOW *win, int x, int y, int left, int right, int up, int down)
@@ -411,34 +642,40 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 	struct table_data *d = w->internal_data;
 	int i, j, k, extra, extra_counter;
 
-	extra = w->h - w->min_h;
-	extra_counter = 0;
-	for (i=0; i < d->rows; i++) {
-		if (d->rowd[i].expand)
-			extra_counter++;
-	}
-	for (i=0; i < d->rows; i++) {
-		if (d->rowd[i].expand) {
-			int e = extra / extra_counter--;
-			d->rowd[i].size = d->rowd[i].min + e;
-			extra -= e;
-		} else
-			d->rowd[i].size = d->rowd[i].min;
-	}
+	if (d->sized_w != w->w || d->sized_h != w->h)
+	{
+		extra = w->h - w->min_h;
+		extra_counter = 0;
+		for (i=0; i < d->rows; i++) {
+			if (d->rowd.expand[i])
+				extra_counter++;
+		}
+		for (i=0; i < d->rows; i++) {
+			if (d->rowd.expand[i]) {
+				int e = extra / extra_counter--;
+				d->rowd.size[i] = d->rowd.min[i] + e;
+				extra -= e;
+			} else
+				d->rowd.size[i] = d->rowd.min[i];
+		}
 
-	extra = w->w - w->min_w;
-	extra_counter = 0;
-	for (i=0; i < d->cols; i++) {
-		if (d->cold[i].expand)
-			extra_counter++;
-	}
-	for (i=0; i < d->cols; i++) {
-		if (d->cold[i].expand) {
-			int e = extra / extra_counter--;
-			d->cold[i].size = d->cold[i].min + e;
-			extra -= e;
-		} else
-			d->cold[i].size = d->cold[i].min;
+		extra = w->w - w->min_w;
+		extra_counter = 0;
+		for (i=0; i < d->cols; i++) {
+			if (d->cold.expand[i])
+				extra_counter++;
+		}
+		for (i=0; i < d->cols; i++) {
+			if (d->cold.expand[i]) {
+				int e = extra / extra_counter--;
+				d->cold.size[i] = d->cold.min[i] + e;
+				extra -= e;
+			} else
+				d->cold.size[i] = d->cold.min[i];
+		}
+
+		d->sized_w = w->w;
+		d->sized_h = w->h;
 	}
 
 	int y = w->y;
@@ -447,19 +684,20 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 		int x = w->x;
 		for (i=0; i < d->cols; i++)
 		{
-			if (d->map[i][j] && !d->map[i][j]->spanpadding)
+			struct table_cell_data *m = table_cell(d, i, j);
+
+			if (m && !m->spanpadding)
 			{
-				struct table_cell_data *m = d->map[i][j];
 				struct stfl_widget *c = m->w;
 
 				c->x = x; c->w = 0;
 				c->y = y; c->h = 0;
 
-				for (k=i; k < i + d->map[i][j]->colspan; k++)
-					c->w += d->cold[k].size;
+				for (k=i; k < i + m->colspan; k++)
+					c->w += d->cold.size[k];
 
-				for (k=j; k < j + d->map[i][j]->rowspan; k++)
-					c->h += d->rowd[k].size;
+				for (k=j; k < j + m->rowspan; k++)
+					c->h += d->rowd.size[k];
 
 				if (m->mc_border_l && i == 0) {
 					c->x += 3;
@@ -477,21 +715,19 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 				if (m->mc_border_b)
 					c->h--;
 
-				const wchar_t *tie = stfl_widget_getkv_str(c, L".tie", L"lrtb");
-				
-				if (!wcschr(tie, L'l') && !wcschr(tie, L'r')) c->x += (c->w - c->min_w)/2;
-				if (!wcschr(tie, L'l') &&  wcschr(tie, L'r')) c->x += c->w - c->min_w;
-				if (!wcschr(tie, L'l') || !wcschr(tie, L'r')) c->w = c->min_w;
-				
-				if (!wcschr(tie, L't') && !wcschr(tie, L'b')) c->y += (c->h - c->min_h)/2;
-				if (!wcschr(tie, L't') &&  wcschr(tie, L'b')) c->y += c->h - c->min_h;
-				if (!wcschr(tie, L't') || !wcschr(tie, L'b')) c->h = c->min_h;
+				if (!m->tie_l && !m->tie_r) c->x += (c->w - c->min_w)/2;
+				if (!m->tie_l &&  m->tie_r) c->x += c->w - c->min_w;
+				if (!m->tie_l || !m->tie_r) c->w = c->min_w;
+
+				if (!m->tie_t && !m->tie_b) c->y += (c->h - c->min_h)/2;
+				if (!m->tie_t &&  m->tie_b) c->y += c->h - c->min_h;
+				if (!m->tie_t || !m->tie_b) c->h = c->min_h;
 
 				c->type->f_draw(c, f, win);
 			}
-			x += d->cold[i].size;
+			x += d->cold.size[i];
 		}
-		y += d->rowd[j].size;
+		y += d->rowd.size[j];
 	}
 
 	stfl_widget_style(w, f, win);
@@ -502,11 +738,12 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 		int x = w->x;
 		for (i=0; i < d->cols; i++)
 		{
-			if (d->map[i][j])
+			struct table_cell_data *m = table_cell(d, i, j);
+
+			if (m)
 			{
-				struct table_cell_data *m = d->map[i][j];
-				int box_x = x, box_w = d->cold[i].size;
-				int box_y = y, box_h = d->rowd[j].size;
+				int box_x = x, box_w = d->cold.size[i];
+				int box_y = y, box_h = d->rowd.size[j];
 
 				if (i == 0) {
 					if (m->border_l > 1 && box_h > (j ? 1 : 2)) {
@@ -540,11 +777,11 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 
 				int left, right, up, down;
 
-				struct table_cell_data *left_m = i > 0 ? d->map[i-1][j] : 0;
-				struct table_cell_data *right_m = i < d->cols-1 ? d->map[i+1][j] : 0;
+				struct table_cell_data *left_m = i > 0 ? table_cell(d, i-1, j) : 0;
+				struct table_cell_data *right_m = i < d->cols-1 ? table_cell(d, i+1, j) : 0;
 
-				struct table_cell_data *up_m = j > 0 ? d->map[i][j-1] : 0;
-				struct table_cell_data *down_m = j < d->rows-1 ? d->map[i][j+1] : 0;
+				struct table_cell_data *up_m = j > 0 ? table_cell(d, i, j-1) : 0;
+				struct table_cell_data *down_m = j < d->rows-1 ? table_cell(d, i, j+1) : 0;
 
 				// upper left corner
 				if (i == 0 && j == 0) {
@@ -580,16 +817,16 @@ static void wt_table_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *wi
 				down = down_m ? down_m->border_r : 0;
 				make_corner(win, box_x+box_w-2, box_y+box_h-1, left>1, right>1, up>1, down>1);
 			}
-			x += d->cold[i].size;
+			x += d->cold.size[i];
 		}
-		y += d->rowd[j].size;
+		y += d->rowd.size[j];
 	}
 }
 
 static int wt_table_process(struct stfl_widget *w, struct stfl_widget *fw, struct stfl_form *f, wchar_t ch, int isfunckey)
 {
 	struct table_data *d = w->internal_data;
-	struct stfl_widget *n, *c;
+	struct stfl_widget *c;
 	int i, j, k, event = 0;
 
 	if (stfl_matchbind(w, ch, isfunckey, L"left", L"LEFT"))
@@ -606,57 +843,47 @@ static int wt_table_process(struct stfl_widget *w, struct stfl_widget *fw, struc
 	else
 		return 0;
 
+	if (d->gen != stfl_layout_gen(w) || !d->cells)
+		table_build(w, d);
+
+	if (!d->linked)
+		table_link(d);
+
 	c = stfl_find_child_tree(w, fw);
+	k = c ? table_hash_lookup(d, c) : -1;
+	if (k < 0)
+		return 0;
 
-	for (j=0; j < d->rows; j++)
-	for (i=0; i < d->cols; i++)
+	struct table_cell_data *m = &d->cells[k];
+	int mi = k % d->alloc_cols;
+	int mj = k / d->alloc_cols;
+
+	for (j=mj; j < mj + m->rowspan; j++)
+	for (i=mi; i < mi + m->colspan; i++)
 	{
-		struct table_cell_data *m = d->map[i][j];
-		if (!m || m->w != c) continue;
+		struct table_cell_data *s = table_cell(d, i, j);
+		int link = -1;
 
 		switch (event)
 		{
 		case KEY_LEFT:
-			for (k=i-1; k >= 0; k--) {
-				m = d->map[k][j];
-				if (!m) continue;
-				n = stfl_find_first_focusable(m->w);
-				if (!n) continue;
-				stfl_switch_focus(fw, n, f);
-				return 1;
-			}
+			link = s->link_l;
 			break;
 		case KEY_RIGHT:
-			for (k=i+1; k < d->cols; k++) {
-				m = d->map[k][j];
-				if (!m) continue;
-				n = stfl_find_first_focusable(m->w);
-				if (!n) continue;
-				stfl_switch_focus(fw, n, f);
-				return 1;
-			}
+			link = s->link_r;
 			break;
 		case KEY_UP:
-			for (k=j-1; k >= 0; k--) {
-				m = d->map[i][k];
-				if (!m) continue;
-				n = stfl_find_first_focusable(m->w);
-				if (!n) continue;
-				stfl_switch_focus(fw, n, f);
-				return 1;
-			}
+			link = s->link_u;
 			break;
 		case KEY_DOWN:
-			for (k=j+1; k < d->rows; k++) {
-				m = d->map[i][k];
-				if (!m) continue;
-				n = stfl_find_first_focusable(m->w);
-				if (!n) continue;
-				stfl_switch_focus(fw, n, f);
-				return 1;
-			}
+			link = s->link_d;
 			break;
 		}
+
+		if (link >= 0) {
+			stfl_switch_focus(fw, d->cells[link].focus, f);
+			return 1;
+		}
 	}
 
 	return 0;
@@ -664,7 +891,7 @@ static int wt_table_process(struct stfl_widget *w, struct stfl_widget *fw, struc
 
 struct stfl_widget_type stfl_widget_type_table = {
 	L"table",
-	0, // f_init
+	wt_table_init,
 	wt_table_done,
 	0, // f_enter 
 	0, // f_leave
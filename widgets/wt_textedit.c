@@ -22,11 +22,124 @@
  */
 
 #include "stfl_internals.h"
+#include "stfl_compat.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <wctype.h>
 
+struct textedit_data {
+	struct stfl_undo undo;
+	unsigned int gen;
+};
+
+static void wt_textedit_init(struct stfl_widget *w)
+{
+	w->internal_data = calloc(1, sizeof(struct textedit_data));
+}
+
+static void wt_textedit_done(struct stfl_widget *w)
+{
+	struct textedit_data *d = w->internal_data;
+	stfl_undo_clear(&d->undo);
+	free(d);
+}
+
+static struct stfl_widget *textedit_line(struct stfl_widget *w, int line)
+{
+	return stfl_widget_child_at(w, line);
+}
+
+static struct stfl_widget *textedit_new_line(struct stfl_widget *w, struct stfl_widget *after)
+{
+	struct stfl_widget *c = stfl_widget_new(L"listitem");
+	stfl_widget_insert(w, after ? after->next_sibling : w->first_child, c);
+	return c;
+}
+
+static void textedit_set_text(struct stfl_widget *c, const wchar_t *a, int a_len, const wchar_t *b, int b_len)
+{
+	wchar_t *text = malloc((a_len + b_len + 1) * sizeof(wchar_t));
+	wmemcpy(text, a, a_len);
+	wmemcpy(text + a_len, b, b_len);
+	text[a_len + b_len] = 0;
+	stfl_widget_setkv_str(c, L"text", text);
+	free(text);
+}
+
+/*
+ * Insert and delete text at a line/column position. Line breaks count as
+ * one '\n' character, so these can replay the records of the undo journal.
+ */
+
+static void textedit_insert(struct stfl_widget *w, int line, int col, const wchar_t *text, int len, int *end_line, int *end_col)
+{
+	struct stfl_widget *c = textedit_line(w, line);
+	const wchar_t *old_text;
+	wchar_t *tail;
+	int seg;
+
+	if (!c)
+		return;
+
+	old_text = stfl_widget_getkv_str(c, L"text", L"");
+	if (col > wcslen(old_text))
+		col = wcslen(old_text);
+	tail = compat_wcsdup(old_text + col);
+
+	for (seg = 0; seg < len && text[seg] != L'\n'; seg++) { }
+	textedit_set_text(c, old_text, col, text, seg);
+	col += seg;
+
+	while (seg < len) {
+		text += seg + 1;
+		len -= seg + 1;
+		for (seg = 0; seg < len && text[seg] != L'\n'; seg++) { }
+		c = textedit_new_line(w, c);
+		textedit_set_text(c, text, seg, L"", 0);
+		line++;
+		col = seg;
+	}
+
+	if (*tail) {
+		old_text = stfl_widget_getkv_str(c, L"text", L"");
+		textedit_set_text(c, old_text, col, tail, wcslen(tail));
+	}
+	free(tail);
+
+	*end_line = line;
+	*end_col = col;
+}
+
+static void textedit_delete(struct stfl_widget *w, int line, int col, int len)
+{
+	struct stfl_widget *c = textedit_line(w, line);
+
+	while (c && len > 0)
+	{
+		const wchar_t *text = stfl_widget_getkv_str(c, L"text", L"");
+		int text_len = wcslen(text);
+
+		if (col > text_len)
+			col = text_len;
+
+		if (col + len <= text_len) {
+			textedit_set_text(c, text, col, text + col + len, text_len - col - len);
+			break;
+		}
+
+		if (c->next_sibling == NULL) {
+			textedit_set_text(c, text, col, L"", 0);
+			break;
+		}
+
+		const wchar_t *next_text = stfl_widget_getkv_str(c->next_sibling, L"text", L"");
+		len -= text_len - col + 1;
+		textedit_set_text(c, text, col, next_text, wcslen(next_text));
+		stfl_widget_free(c->next_sibling);
+	}
+}
+
 static void wt_textedit_prepare(struct stfl_widget *w, struct stfl_form *f)
 {
 	struct stfl_widget *c = w->first_child;
@@ -81,11 +194,9 @@ static void wt_textedit_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW
 	int i, j;
 
 	stfl_style(win, style_normal);
-	for (i = 0, c = w->first_child; c && i < scroll_y + w->h; i++, c = c->next_sibling)
+	i = scroll_y > 0 ? scroll_y : 0;
+	for (c = stfl_widget_child_at(w, i); c && i < scroll_y + w->h; i++, c = c->next_sibling)
 	{
-		if (i < scroll_y)
-			continue;
-
 		const wchar_t *text = stfl_widget_getkv_str(c, L"text", L"");
 
 		if (i == cursor_y)
@@ -105,22 +216,16 @@ static void wt_textedit_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW
 	}
 }
 
-static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, struct stfl_form *f, wchar_t ch, int isfunckey)
+static int textedit_process(struct stfl_widget *w, struct textedit_data *d, wchar_t ch, int isfunckey)
 {
 	int cursor_x = stfl_widget_getkv_int(w, L"cursor_x", 0);
 	int cursor_y = stfl_widget_getkv_int(w, L"cursor_y", 0);
 	int num_lines = 0, line_length = 0;
 
-	struct stfl_widget *c_current_line = NULL;
-	struct stfl_widget *c = w->first_child;
-	while (c) {
-		if (num_lines == cursor_y) {
-			line_length = wcslen(stfl_widget_getkv_str(c, L"text", L""));
-			c_current_line = c;
-		}
-		c = c->next_sibling;
-		num_lines++;
-	}
+	struct stfl_widget *c_current_line = stfl_widget_child_at(w, cursor_y);
+	num_lines = stfl_widget_child_count(w);
+	if (c_current_line)
+		line_length = wcslen(stfl_widget_getkv_str(c_current_line, L"text", L""));
 
 	if (c_current_line == NULL) {
 		c_current_line = w->last_child;
@@ -128,12 +233,48 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 	}
 
 	if (c_current_line == NULL) {
-		c_current_line = stfl_widget_new(L"listitem");
-		w->last_child = c_current_line;
-		w->first_child = c_current_line;
+		c_current_line = textedit_new_line(w, NULL);
 		num_lines = 1;
 	}
 
+	if (stfl_matchbind(w, ch, isfunckey, L"undo", L"")) {
+		struct stfl_undo_rec *r = stfl_undo_undo(&d->undo);
+		int end_y = 0, end_x = 0;
+		if (r == NULL)
+			return 0;
+		if (r->type == STFL_UNDO_INSERT) {
+			textedit_delete(w, r->line, r->col, r->len);
+			end_y = r->line;
+			end_x = r->col;
+		} else {
+			textedit_insert(w, r->line, r->col, r->text, r->len, &end_y, &end_x);
+			if (!r->backward) {
+				end_y = r->line;
+				end_x = r->col;
+			}
+		}
+		stfl_widget_setkv_int(w, L"cursor_x", end_x);
+		stfl_widget_setkv_int(w, L"cursor_y", end_y);
+		return 1;
+	}
+
+	if (stfl_matchbind(w, ch, isfunckey, L"redo", L"")) {
+		struct stfl_undo_rec *r = stfl_undo_redo(&d->undo);
+		int end_y = 0, end_x = 0;
+		if (r == NULL)
+			return 0;
+		if (r->type == STFL_UNDO_INSERT) {
+			textedit_insert(w, r->line, r->col, r->text, r->len, &end_y, &end_x);
+		} else {
+			textedit_delete(w, r->line, r->col, r->len);
+			end_y = r->line;
+			end_x = r->col;
+		}
+		stfl_widget_setkv_int(w, L"cursor_x", end_x);
+		stfl_widget_setkv_int(w, L"cursor_y", end_y);
+		return 1;
+	}
+
 	if (cursor_y > 0 && stfl_matchbind(w, ch, isfunckey, L"up", L"UP")) {
 		stfl_widget_setkv_int(w, L"cursor_y", cursor_y-1);
 		return 1;
@@ -195,6 +336,7 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 			wchar_t newtext[wcslen(this_text) + wcslen(next_text) + 1];
 			wcscpy(newtext, this_text);
 			wcscat(newtext, next_text);
+			stfl_undo_add(&d->undo, STFL_UNDO_DELETE, cursor_y, line_length, L"\n", 1, 0);
 			stfl_widget_setkv_int(w, L"cursor_x", line_length);
 			stfl_widget_setkv_str(c_current_line, L"text", newtext);
 			stfl_widget_free(c_current_line->next_sibling);
@@ -203,6 +345,7 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 
 		wchar_t newtext[line_length];
 		const wchar_t *text = stfl_widget_getkv_str(c_current_line, L"text", L"");
+		stfl_undo_add(&d->undo, STFL_UNDO_DELETE, cursor_y, cursor_x, text + cursor_x, 1, 0);
 		wmemcpy(newtext, text, cursor_x);
 		wcscpy(newtext + cursor_x, text + cursor_x + 1);
 		stfl_widget_setkv_str(c_current_line, L"text", newtext);
@@ -218,9 +361,7 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 			cursor_x = line_length;
 
 		if (cursor_x == 0) {
-			struct stfl_widget *c = w->first_child;
-			while (c && c->next_sibling != c_current_line)
-				c = c->next_sibling;
+			struct stfl_widget *c = c_current_line->prev_sibling;
 			if (c == NULL)
 				return 0;
 			const wchar_t *prev_text = stfl_widget_getkv_str(c, L"text", L"");
@@ -228,6 +369,7 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 			wchar_t newtext[wcslen(prev_text) + wcslen(this_text) + 1];
 			wcscpy(newtext, prev_text);
 			wcscat(newtext, this_text);
+			stfl_undo_add(&d->undo, STFL_UNDO_DELETE, cursor_y - 1, wcslen(prev_text), L"\n", 1, 1);
 			stfl_widget_setkv_int(w, L"cursor_x", wcslen(prev_text));
 			stfl_widget_setkv_int(w, L"cursor_y", cursor_y - 1);
 			stfl_widget_setkv_str(c, L"text", newtext);
@@ -237,6 +379,7 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 
 		wchar_t newtext[line_length];
 		const wchar_t *text = stfl_widget_getkv_str(c_current_line, L"text", L"");
+		stfl_undo_add(&d->undo, STFL_UNDO_DELETE, cursor_y, cursor_x - 1, text + cursor_x - 1, 1, 1);
 		wmemcpy(newtext, text, cursor_x-1);
 		wcscpy(newtext + cursor_x - 1, text + cursor_x);
 		stfl_widget_setkv_str(c_current_line, L"text", newtext);
@@ -247,26 +390,15 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 	if (stfl_matchbind(w, ch, isfunckey, L"enter", L"ENTER"))
 	{
 		if (c_current_line == NULL) {
-			c_current_line = stfl_widget_new(L"listitem");
-			c_current_line->parent = w;
-			if (w->last_child)
-				w->last_child->next_sibling = c_current_line;
-			else
-				w->first_child = c_current_line;
-			w->last_child = c_current_line;
+			textedit_new_line(w, w->last_child);
 			return 1;
 		}
 
 		if (cursor_x > line_length)
 			cursor_x = line_length;
 
-		c = stfl_widget_new(L"listitem");
-		c->parent = w;
-		c->next_sibling = c_current_line->next_sibling;
-		c_current_line->next_sibling = c;
-
-		if (w->last_child == c_current_line)
-			w->last_child = c;
+		stfl_undo_add(&d->undo, STFL_UNDO_INSERT, cursor_y, cursor_x, L"\n", 1, 0);
+		struct stfl_widget *c = textedit_new_line(w, c_current_line);
 
 		const wchar_t *text = stfl_widget_getkv_str(c_current_line, L"text", L"");
 		stfl_widget_setkv_str(c, L"text", text + cursor_x);
@@ -283,19 +415,14 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 
 	if (!isfunckey && iswprint(ch))
 	{
-		if (c_current_line == NULL) {
-			c_current_line = stfl_widget_new(L"listitem");
-			c_current_line->parent = w;
-			if (w->last_child)
-				w->last_child->next_sibling = c_current_line;
-			else
-				w->first_child = c_current_line;
-			w->last_child = c_current_line;
-		}
+		if (c_current_line == NULL)
+			c_current_line = textedit_new_line(w, w->last_child);
 
 		if (cursor_x > line_length)
 			cursor_x = line_length;
 
+		stfl_undo_add(&d->undo, STFL_UNDO_INSERT, cursor_y, cursor_x, &ch, 1, 0);
+
 		wchar_t newtext[line_length + 1];
 		const wchar_t *text = stfl_widget_getkv_str(c_current_line, L"text", L"");
 		wmemcpy(newtext, text, cursor_x);
@@ -310,10 +437,30 @@ static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, st
 	return 0;
 }
 
+static int wt_textedit_process(struct stfl_widget *w, struct stfl_widget *fw, struct stfl_form *f, wchar_t ch, int isfunckey)
+{
+	struct textedit_data *d = w->internal_data;
+
+	// the text has been changed from outside
+	if (d->gen != w->child_gen)
+		stfl_undo_clear(&d->undo);
+
+	d->undo.limit = stfl_widget_getkv_int(w, L"undo_limit", 65536);
+
+	int rc = textedit_process(w, d, ch, isfunckey);
+
+	// cursor movement ends the current run of typing
+	if (rc && d->gen == w->child_gen)
+		stfl_undo_break(&d->undo);
+
+	d->gen = w->child_gen;
+	return rc;
+}
+
 struct stfl_widget_type stfl_widget_type_textedit = {
 	L"textedit",
-	0, // f_init
-	0, // f_done
+	wt_textedit_init,
+	wt_textedit_done,
 	0, // f_enter 
 	0, // f_leave
 	wt_textedit_prepare,
@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <wctype.h>
 
 #if 0
 static void fix_offset_pos(struct stfl_widget *w)
@@ -60,6 +61,313 @@ static void fix_offset_pos(struct stfl_widget *w)
 }
 #endif
 
+/*
+ * With 'wrap' set every listitem is a paragraph that is broken into rows
+ * at word boundaries. The row breaks of each paragraph are cached together
+ * with the width and the generation of the text they were computed for, so
+ * only changed paragraphs are wrapped again. The row sums are extended on
+ * demand, so drawing near the top of a long text doesn't wrap all of it.
+ *
+ * With 'richtext' set every paragraph also remembers the style tag that is
+ * active at its start (as paragraph and position of the tag, -1 for the
+ * normal style), so drawing at an offset doesn't replay all lines above.
+ */
+
+struct textview_para {
+	struct stfl_widget *c;
+	struct stfl_kv *kv;
+	unsigned int gen;
+	int width, rows, alloc;
+	int *breaks;
+	int style_para, style_pos;
+};
+
+struct textview_data {
+	struct textview_para *paras;
+	int *row_sums;
+	int count, alloc, valid, styled;
+	int width, richtext;
+	unsigned int child_gen;
+};
+
+static void wt_textview_init(struct stfl_widget *w)
+{
+	w->internal_data = calloc(1, sizeof(struct textview_data));
+}
+
+static void wt_textview_done(struct stfl_widget *w)
+{
+	struct textview_data *d = w->internal_data;
+	int i;
+
+	for (i = 0; i < d->alloc; i++)
+		free(d->paras[i].breaks);
+
+	free(d->paras);
+	free(d->row_sums);
+	free(d);
+}
+
+static int token_len(const wchar_t *p, int richtext, int *width)
+{
+	if (richtext && *p == L'<') {
+		const wchar_t *end = wcschr(p + 1, L'>');
+		if (end == NULL) {
+			*width = 0;
+			return wcslen(p);
+		}
+		*width = end == p + 1 ? 1 : 0;
+		return end - p + 1;
+	}
+
+	*width = wcwidth(*p);
+	if (*width < 0)
+		*width = 1;
+	return 1;
+}
+
+static int span_width(const wchar_t *text, int from, int to, int richtext)
+{
+	int width = 0, cw;
+	while (from < to) {
+		from += token_len(text + from, richtext, &cw);
+		width += cw;
+	}
+	return width;
+}
+
+/* number of plain text characters from text that fit into width columns */
+static int fit_len(const wchar_t *text, int len, int width)
+{
+	int n = 0, cw;
+	while (n < len) {
+		token_len(text + n, 0, &cw);
+		if (cw > width)
+			break;
+		width -= cw;
+		n++;
+	}
+	return n;
+}
+
+static void para_add_break(struct textview_para *p, int pos)
+{
+	if (p->rows + 1 >= p->alloc) {
+		p->alloc = p->alloc * 2 + 8;
+		p->breaks = realloc(p->breaks, p->alloc * sizeof(int));
+	}
+	p->breaks[p->rows++] = pos;
+}
+
+static void para_wrap(struct textview_para *p, int width, int richtext)
+{
+	const wchar_t *text = p->kv ? p->kv->value : L"";
+	int start = 0, pos = 0, col = 0, last_space = -1;
+	int len, cw;
+
+	p->rows = 0;
+	para_add_break(p, 0);
+
+	while (text[pos])
+	{
+		len = token_len(text + pos, richtext, &cw);
+
+		if (width > 0 && cw > 0 && col + cw > width && col > 0) {
+			if (iswspace(text[pos])) {
+				// let the space hang at the end of the row
+				start = pos + len;
+				if (text[start])
+					para_add_break(p, start);
+				col = 0;
+				last_space = -1;
+				pos += len;
+				continue;
+			}
+			start = last_space >= start ? last_space + 1 : pos;
+			para_add_break(p, start);
+			col = span_width(text, start, pos, richtext);
+			last_space = -1;
+		}
+
+		if (cw > 0 && iswspace(text[pos]))
+			last_space = pos;
+
+		col += cw;
+		pos += len;
+	}
+
+	// end of the last row
+	p->breaks[p->rows] = pos;
+}
+
+static struct textview_data *textview_data(struct stfl_widget *w)
+{
+	struct textview_data *d = w->internal_data;
+	int richtext = stfl_widget_getkv_int(w, L"richtext", 0);
+	struct stfl_widget *c;
+	int i;
+
+	if (d->richtext != richtext) {
+		for (i = 0; i < d->count; i++)
+			d->paras[i].width = -1;
+		d->richtext = richtext;
+		d->valid = 0;
+	}
+
+	if (d->width != w->w) {
+		d->width = w->w;
+		d->valid = 0;
+	}
+
+	if (d->child_gen == w->child_gen && d->paras)
+		return d;
+
+	for (i = 0, c = w->first_child; c; i++, c = c->next_sibling)
+	{
+		if (i == d->alloc) {
+			d->alloc = d->alloc * 2 + 16;
+			d->paras = realloc(d->paras, d->alloc * sizeof(struct textview_para));
+			d->row_sums = realloc(d->row_sums, (d->alloc + 1) * sizeof(int));
+			memset(d->paras + i, 0, (d->alloc - i) * sizeof(struct textview_para));
+			d->row_sums[0] = 0;
+		}
+
+		struct textview_para *p = &d->paras[i];
+		struct stfl_kv *kv = stfl_widget_getkv(c, L"text");
+
+		if (p->c != c || p->kv != kv || (kv && p->gen != kv->gen)) {
+			p->c = c;
+			p->kv = kv;
+			p->gen = kv ? kv->gen : 0;
+			p->width = -1;
+		}
+	}
+
+	d->count = i;
+	d->valid = 0;
+	d->styled = 0;
+	d->child_gen = w->child_gen;
+	return d;
+}
+
+static struct textview_para *textview_para(struct textview_data *d, int i)
+{
+	struct textview_para *p = &d->paras[i];
+
+	if (p->width != d->width) {
+		para_wrap(p, d->width, d->richtext);
+		p->width = d->width;
+	}
+
+	return p;
+}
+
+static void textview_extend(struct textview_data *d, int i)
+{
+	while (d->valid < i && d->valid < d->count) {
+		d->row_sums[d->valid + 1] = d->row_sums[d->valid] + textview_para(d, d->valid)->rows;
+		d->valid++;
+	}
+}
+
+static int textview_rows(struct textview_data *d)
+{
+	textview_extend(d, d->count);
+	return d->row_sums[d->count];
+}
+
+/* find the paragraph containing the given row */
+static int textview_find_row(struct textview_data *d, int row, int *para_row)
+{
+	int lo = 0, hi;
+
+	*para_row = 0;
+	while (d->valid < d->count && d->row_sums[d->valid] <= row)
+		textview_extend(d, d->valid + 1);
+
+	if (d->row_sums[d->valid] <= row)
+		return d->count;
+
+	hi = d->valid;
+	while (lo + 1 < hi) {
+		int mid = (lo + hi) / 2;
+		if (d->row_sums[mid] <= row)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*para_row = row - d->row_sums[lo];
+	return lo;
+}
+
+static const wchar_t *para_text(struct textview_para *p)
+{
+	return p->kv ? p->kv->value : L"";
+}
+
+static void textview_checkpoint(struct textview_data *d, int i)
+{
+	if (d->styled == 0 && d->count > 0) {
+		d->paras[0].style_para = -1;
+		d->paras[0].style_pos = 0;
+		d->styled = 1;
+	}
+
+	while (d->styled <= i && d->styled < d->count)
+	{
+		struct textview_para *prev = &d->paras[d->styled - 1];
+		struct textview_para *p = &d->paras[d->styled];
+		const wchar_t *text = para_text(prev);
+		const wchar_t *p1 = text, *p2;
+
+		p->style_para = prev->style_para;
+		p->style_pos = prev->style_pos;
+
+		while ((p1 = wcschr(p1, L'<')) != NULL && (p2 = wcschr(p1 + 1, L'>')) != NULL) {
+			if (p2 == p1 + 2 && p1[1] == L'/') {
+				p->style_para = -1;
+			} else if (p2 != p1 + 1) {
+				p->style_para = d->styled - 1;
+				p->style_pos = p1 - text;
+			}
+			p1 = p2 + 1;
+		}
+
+		d->styled++;
+	}
+}
+
+/* restore the richtext style that is active at the start of paragraph i */
+static void textview_restore_style(struct stfl_widget *w, WINDOW *win, struct textview_data *d, int i, const wchar_t *style_normal)
+{
+	if (i >= d->count) {
+		stfl_style(win, style_normal);
+		return;
+	}
+
+	textview_checkpoint(d, i);
+
+	struct textview_para *p = &d->paras[i];
+	if (p->style_para < 0) {
+		stfl_style(win, style_normal);
+		return;
+	}
+
+	const wchar_t *tag = para_text(&d->paras[p->style_para]) + p->style_pos;
+	int tag_len = wcschr(tag, L'>') - tag + 1;
+	wchar_t tag_text[tag_len + 1];
+	wmemcpy(tag_text, tag, tag_len);
+	tag_text[tag_len] = 0;
+
+	stfl_print_richtext(w, win, w->y, w->x, tag_text, 0, style_normal, 0);
+}
+
+static int textview_wrap(struct stfl_widget *w)
+{
+	return stfl_widget_getkv_int(w, L"wrap", 0) && w->first_child;
+}
+
 static void wt_textview_prepare(struct stfl_widget *w, struct stfl_form *f)
 {
 	struct stfl_widget *c = w->first_child;
@@ -70,6 +378,9 @@ static void wt_textview_prepare(struct stfl_widget *w, struct stfl_form *f)
 	if (c)
 		w->allow_focus = 1;
 
+	if (stfl_widget_getkv_int(w, L"wrap", 0))
+		return;
+
 	while (c) {
 		const wchar_t * text = stfl_widget_getkv_str(c, L"text", L"");
 		int len = wcswidth(text, wcslen(text));
@@ -78,7 +389,48 @@ static void wt_textview_prepare(struct stfl_widget *w, struct stfl_form *f)
 	}
 }
 
+static void wt_textview_draw_wrap(struct stfl_widget *w, struct stfl_form *f, WINDOW *win, int offset, const wchar_t *style_normal)
+{
+	struct textview_data *d = textview_data(w);
+	struct textview_para *p;
+	const wchar_t *text;
+	int i, k, y = 0;
+
+	i = textview_find_row(d, offset, &k);
+
+	if (d->richtext) {
+		textview_restore_style(w, win, d, i, style_normal);
+		if (i < d->count && k > 0) {
+			p = textview_para(d, i);
+			stfl_print_richtext_range(w, win, w->y, w->x, p->kv, 0, p->breaks[k], 0, style_normal, 0);
+		}
+	}
+
+	for (; i < d->count && y < w->h; i++, k = 0)
+	{
+		p = textview_para(d, i);
+		text = para_text(p);
+
+		for (; k < p->rows && y < w->h; k++, y++)
+		{
+			int len = p->breaks[k+1] - p->breaks[k];
+
+			if (d->richtext) {
+				stfl_print_richtext_range(w, win, w->y+y, w->x, p->kv,
+						p->breaks[k], p->breaks[k+1], w->w, style_normal, 0);
+			} else {
+				// a space hanging at the end of a full row doesn't fit
+				mvwaddnwstr(win, w->y+y, w->x, text + p->breaks[k],
+						fit_len(text + p->breaks[k], len, w->w));
+			}
+		}
+	}
 
+	const wchar_t *style_end = stfl_widget_getkv_str(w, L"style_end", L"");
+	stfl_style(win, style_end);
+	for (; y < w->h; y++)
+		mvwaddnwstr(win, w->y+y, w->x, L"~", w->w);
+}
 
 static void wt_textview_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW *win)
 {
@@ -90,22 +442,29 @@ static void wt_textview_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW
 	const wchar_t *style_normal = stfl_widget_getkv_str(w, L"style_normal", L"");
 	const wchar_t *style_end = stfl_widget_getkv_str(w, L"style_end", L"");
 
-	struct stfl_widget *c;
+	struct textview_data *d;
 	int i;
 
+	if (offset < 0)
+		offset = 0;
+
 	stfl_style(win, style_normal);
-	for (i=0, c=w->first_child; c && i < offset+w->h; i++, c=c->next_sibling)
-	{
-		const wchar_t *text = stfl_widget_getkv_str(c, L"text", L"");
 
-		if (i < offset) {
-			if (is_richtext)
-				stfl_print_richtext(w, win, w->y, w->x, text, 0, style_normal, 0);
-			continue;
-		}
+	if (textview_wrap(w)) {
+		wt_textview_draw_wrap(w, f, win, offset, style_normal);
+		goto finish;
+	}
+
+	d = textview_data(w);
+	if (is_richtext)
+		textview_restore_style(w, win, d, offset, style_normal);
+
+	for (i=offset; i < d->count && i < offset+w->h; i++)
+	{
+		const wchar_t *text = para_text(&d->paras[i]);
 
 		if (is_richtext) {
-			stfl_print_richtext(w, win, w->y+i-offset, w->x, text, w->w, style_normal, 0);
+			stfl_print_richtext_kv(w, win, w->y+i-offset, w->x, d->paras[i].kv, w->w, style_normal, 0);
 		} else {
 			mvwaddnwstr(win, w->y+i-offset, w->x, text, w->w);
 		}
@@ -117,6 +476,7 @@ static void wt_textview_draw(struct stfl_widget *w, struct stfl_form *f, WINDOW
 		++i;
 	}
 
+finish:
 	if (f->current_focus_id == w->id)
 		f->root->cur_x = f->root->cur_y = f->cursor_x = f->cursor_y = -1;
 }
@@ -127,11 +487,10 @@ static int wt_textview_process(struct stfl_widget *w, struct stfl_widget *fw, st
 	int offset = stfl_widget_getkv_int(w,L"offset",0);
 	int maxoffset = -1;
 
-	struct stfl_widget *c = w->first_child;
-	while (c) {
-		maxoffset++;
-		c = c->next_sibling;
-	}
+	if (textview_wrap(w))
+		maxoffset = textview_rows(textview_data(w)) - 1;
+	else
+		maxoffset = textview_data(w)->count - 1;
 
 	if (offset > 0 && stfl_matchbind(w, ch, isfunckey, L"up", L"UP")) {
 		stfl_widget_setkv_int(w, L"offset", offset-1);
@@ -179,8 +538,8 @@ static int wt_textview_process(struct stfl_widget *w, struct stfl_widget *fw, st
 
 struct stfl_widget_type stfl_widget_type_textview = {
 	L"textview",
-	0, // f_init
-	0, // f_done
+	wt_textview_init,
+	wt_textview_done,
 	0, // f_enter 
 	0, // f_leave
 	wt_textview_prepare,